@@ -0,0 +1,582 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "VisionVehicles.h"
+#include "DriveRecording.h"
+#include "MappedFile.h"
+#include "NeuralNetwork.h"
+#include "HAL/RunnableThread.h"
+
+/* The header of a drive recording file. It is followed by the chunks of records, and by the index when the recording was closed.
+ *	All the headers and records are multiples of 8 bytes, so the records and their masks can be read in place.
+ *	The values are stored in the byte order of the machine that wrote the file, so they can be read without conversion.
+ *	A file written with the other byte order doesn't match the magic number, and is rejected. */
+struct FDriveRecordingFileHeader
+{
+	// The identifier of drive recording files
+	static const uint32 FileMagic = 0x52445656; // "VVDR"
+
+	// The current version of the format
+	static const uint32 FileVersion = 1;
+
+	uint32 magic;
+	uint32 version;
+	int32 numFeatures;
+	int32 maskWidth;
+	int32 maskHeight;
+	int32 recordSize;
+	uint32 reserved[2];
+};
+
+/* The header of a chunk of records, which follow it. */
+struct FDriveRecordingChunkHeader
+{
+	// The identifier of chunks
+	static const uint32 ChunkMagic = 0x4B484356; // "VCHK"
+
+	uint32 magic;
+	int32 numRecords;
+	uint32 checksum; // CRC32 of the records
+	uint32 reserved;
+};
+
+/* An entry of the index, for each chunk. */
+struct FDriveRecordingIndexEntry
+{
+	int64 offset; // Of the chunk header
+	int32 firstRecord;
+	int32 numRecords;
+};
+
+/* The end of a recording that was closed, after the entries of the index. */
+struct FDriveRecordingFooter
+{
+	// The identifier of the footer
+	static const uint32 FooterMagic = 0x58445656; // "VVDX"
+
+	int64 indexOffset;
+	int32 numChunks;
+	uint32 magic;
+};
+
+// Returns the size of a record with the given number of features and mask size
+static int32 GetRecordSize(int32 numFeatures, int32 maskWidth, int32 maskHeight)
+{
+	return sizeof(FDriveRecord) + Align(numFeatures * (int32)sizeof(float), 8) + (maskWidth * maskHeight + 63) / 64 * (int32)sizeof(uint64);
+}
+
+const double FDriveRecorder::ChunkFlushTime = 1.0;
+
+FDriveRecorder::FDriveRecorder(int32 _numFeatures, int32 _maskWidth, int32 _maskHeight, int32 _numSlots)
+	: queuedSlots(_numSlots + 1), freeSlots(_numSlots + 1)
+{
+	numFeatures = _numFeatures;
+	maskWidth = _maskWidth;
+	maskHeight = _maskHeight;
+	recordSize = GetRecordSize(numFeatures, maskWidth, maskHeight);
+
+	slots.SetNumZeroed(_numSlots * recordSize);
+	for (int32 slot = 0; slot < _numSlots; slot++)
+	{
+		freeSlots.Enqueue(slot);
+	}
+	chunk.SetNumZeroed(RecordsPerChunk * recordSize);
+	numChunkRecords = 0;
+	lastChunkTime = FPlatformTime::Seconds();
+
+	thread = nullptr;
+	wakeEvent = FPlatformProcess::GetSynchEventFromPool();
+	numRecorded = 0;
+	numDropped = 0;
+}
+
+FDriveRecorder::~FDriveRecorder()
+{
+	Close();
+	FPlatformProcess::ReturnSynchEventToPool(wakeEvent);
+}
+
+TUniquePtr<FDriveRecorder> FDriveRecorder::Create(const FString& fileName, int32 numFeatures, int32 maskWidth, int32 maskHeight, int32 numSlots)
+{
+	FArchive* writer = IFileManager::Get().CreateFileWriter(*fileName);
+	if (writer == nullptr)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not create the drive recording %s."), *fileName);
+		return nullptr;
+	}
+
+	bool bHasMasks = maskWidth > 0 && maskHeight > 0;
+	TUniquePtr<FDriveRecorder> recorder(new FDriveRecorder(FMath::Max(numFeatures, 0), bHasMasks ? maskWidth : 0, bHasMasks ? maskHeight : 0,
+		FMath::RoundUpToPowerOfTwo(FMath::Max(numSlots, 1))));
+	recorder->writer = TUniquePtr<FArchive>(writer);
+
+	FDriveRecordingFileHeader header;
+	FMemory::Memzero(header);
+	header.magic = FDriveRecordingFileHeader::FileMagic;
+	header.version = FDriveRecordingFileHeader::FileVersion;
+	header.numFeatures = recorder->numFeatures;
+	header.maskWidth = recorder->maskWidth;
+	header.maskHeight = recorder->maskHeight;
+	header.recordSize = recorder->recordSize;
+	writer->Serialize(&header, sizeof(header));
+	writer->Flush();
+
+	// Without threads, the records are written by Record instead
+	if (FPlatformProcess::SupportsMultithreading())
+	{
+		recorder->thread = FRunnableThread::Create(recorder.Get(), TEXT("DriveRecorder"), 0, TPri_BelowNormal);
+	}
+	return recorder;
+}
+
+bool FDriveRecorder::Record(const FDriveRecord& record, const float* features, const FVisionMask* mask)
+{
+	int32 slot;
+	if (bStopping || !freeSlots.Dequeue(slot))
+	{
+		++numDropped;
+		return false;
+	}
+
+	uint8* data = slots.GetData() + (int64)slot * recordSize;
+	FDriveRecord fixed = record;
+	fixed.Flags &= ~FDriveRecord::HasMask;
+	FMemory::Memcpy(data + sizeof(FDriveRecord), features, numFeatures * sizeof(float));
+
+	if (maskWidth > 0)
+	{
+		uint8* maskData = data + sizeof(FDriveRecord) + Align(numFeatures * (int32)sizeof(float), 8);
+		int32 maskBytes = (maskWidth * maskHeight + 63) / 64 * sizeof(uint64);
+		if (mask != nullptr && mask->Width == maskWidth && mask->Height == maskHeight && mask->Words.Num() * (int32)sizeof(uint64) == maskBytes)
+		{
+			FMemory::Memcpy(maskData, mask->Words.GetData(), maskBytes);
+			fixed.Flags |= FDriveRecord::HasMask;
+		}
+		else
+		{
+			FMemory::Memzero(maskData, maskBytes);
+		}
+	}
+	FMemory::Memcpy(data, &fixed, sizeof(FDriveRecord));
+
+	queuedSlots.Enqueue(slot);
+	++numRecorded;
+	if (thread == nullptr)
+	{
+		WriteQueuedRecords();
+	}
+	return true;
+}
+
+void FDriveRecorder::Close()
+{
+	if (!writer.IsValid())
+	{
+		return;
+	}
+
+	bStopping = true;
+	if (thread != nullptr)
+	{
+		wakeEvent->Trigger();
+		thread->WaitForCompletion();
+		delete thread;
+		thread = nullptr;
+	}
+
+	// Write what is left, then the index of the chunks
+	WriteQueuedRecords();
+	if (numChunkRecords > 0)
+	{
+		WriteChunk();
+	}
+
+	FDriveRecordingFooter footer;
+	footer.indexOffset = writer->Tell();
+	footer.numChunks = chunkOffsets.Num();
+	footer.magic = FDriveRecordingFooter::FooterMagic;
+	int32 firstRecord = 0;
+	for (int32 i = 0; i < chunkOffsets.Num(); i++)
+	{
+		FDriveRecordingIndexEntry entry;
+		entry.offset = chunkOffsets[i];
+		entry.firstRecord = firstRecord;
+		entry.numRecords = chunkRecords[i];
+		writer->Serialize(&entry, sizeof(entry));
+		firstRecord += chunkRecords[i];
+	}
+	writer->Serialize(&footer, sizeof(footer));
+
+	if (writer->IsError())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not write all of a drive recording."));
+	}
+	writer->Close();
+	writer.Reset();
+}
+
+uint32 FDriveRecorder::Run()
+{
+	while (!bStopping)
+	{
+		WriteQueuedRecords();
+
+		// Don't keep records waiting for long when they come slowly, so they aren't lost if the game crashes
+		if (numChunkRecords > 0 && FPlatformTime::Seconds() - lastChunkTime >= ChunkFlushTime)
+		{
+			WriteChunk();
+		}
+		wakeEvent->Wait(10);
+	}
+	return 0;
+}
+
+void FDriveRecorder::Stop()
+{
+	bStopping = true;
+	wakeEvent->Trigger();
+}
+
+bool FDriveRecorder::WriteQueuedRecords()
+{
+	bool bWritten = false;
+	int32 slot;
+	while (queuedSlots.Dequeue(slot))
+	{
+		FMemory::Memcpy(chunk.GetData() + numChunkRecords * recordSize, slots.GetData() + (int64)slot * recordSize, recordSize);
+		freeSlots.Enqueue(slot);
+		bWritten = true;
+
+		if (++numChunkRecords == RecordsPerChunk)
+		{
+			WriteChunk();
+		}
+	}
+	return bWritten;
+}
+
+void FDriveRecorder::WriteChunk()
+{
+	FDriveRecordingChunkHeader header;
+	header.magic = FDriveRecordingChunkHeader::ChunkMagic;
+	header.numRecords = numChunkRecords;
+	header.checksum = FCrc::MemCrc32(chunk.GetData(), numChunkRecords * recordSize);
+	header.reserved = 0;
+
+	chunkOffsets.Add(writer->Tell());
+	chunkRecords.Add(numChunkRecords);
+	writer->Serialize(&header, sizeof(header));
+	writer->Serialize(chunk.GetData(), numChunkRecords * recordSize);
+	writer->Flush();
+
+	numChunkRecords = 0;
+	lastChunkTime = FPlatformTime::Seconds();
+}
+
+FDriveRecording::FDriveRecording()
+{
+	numFeatures = 0;
+	maskWidth = 0;
+	maskHeight = 0;
+	recordSize = 0;
+	numRecords = 0;
+}
+
+TSharedPtr<FDriveRecording, ESPMode::ThreadSafe> FDriveRecording::Open(const FString& fileName)
+{
+	TSharedPtr<FMappedFile, ESPMode::ThreadSafe> file = FMappedFile::Open(fileName);
+	if (!file.IsValid())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not open the drive recording %s."), *fileName);
+		return nullptr;
+	}
+
+	// Validate the header
+	FDriveRecordingFileHeader header;
+	if (file->Num() < (int64)sizeof(header))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("The drive recording %s is truncated."), *fileName);
+		return nullptr;
+	}
+	FMemory::Memcpy(&header, file->GetData(), sizeof(header));
+	if (header.magic != FDriveRecordingFileHeader::FileMagic || header.version != FDriveRecordingFileHeader::FileVersion)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("The file %s is not a drive recording of version %d."), *fileName, FDriveRecordingFileHeader::FileVersion);
+		return nullptr;
+	}
+	if (header.numFeatures < 0 || header.maskWidth < 0 || header.maskHeight < 0
+		|| header.recordSize != GetRecordSize(header.numFeatures, header.maskWidth, header.maskHeight))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("The drive recording %s is corrupt."), *fileName);
+		return nullptr;
+	}
+
+	TSharedPtr<FDriveRecording, ESPMode::ThreadSafe> recording = MakeShareable(new FDriveRecording());
+	recording->file = file;
+	recording->numFeatures = header.numFeatures;
+	recording->maskWidth = header.maskWidth;
+	recording->maskHeight = header.maskHeight;
+	recording->recordSize = header.recordSize;
+
+	// Read the index, checking that its chunks are in the file
+	FDriveRecordingFooter footer;
+	bool bIndexed = false;
+	if (file->Num() >= (int64)(sizeof(header) + sizeof(footer)))
+	{
+		FMemory::Memcpy(&footer, file->GetData() + file->Num() - sizeof(footer), sizeof(footer));
+		bIndexed = footer.magic == FDriveRecordingFooter::FooterMagic && footer.numChunks >= 0 && footer.indexOffset >= (int64)sizeof(header)
+			&& footer.indexOffset + footer.numChunks * (int64)sizeof(FDriveRecordingIndexEntry) + (int64)sizeof(footer) == file->Num();
+	}
+	for (int32 i = 0; bIndexed && i < footer.numChunks; i++)
+	{
+		FDriveRecordingIndexEntry entry;
+		FMemory::Memcpy(&entry, file->GetData() + footer.indexOffset + i * sizeof(entry), sizeof(entry));
+		FDriveRecordingChunkHeader chunkHeader;
+		bIndexed = entry.offset >= (int64)sizeof(header) && entry.firstRecord == recording->numRecords && entry.numRecords > 0
+			&& entry.offset + (int64)sizeof(chunkHeader) + (int64)entry.numRecords * header.recordSize <= footer.indexOffset;
+		if (bIndexed)
+		{
+			FMemory::Memcpy(&chunkHeader, file->GetData() + entry.offset, sizeof(chunkHeader));
+			bIndexed = chunkHeader.magic == FDriveRecordingChunkHeader::ChunkMagic && chunkHeader.numRecords == entry.numRecords;
+		}
+		if (bIndexed)
+		{
+			recording->chunkOffsets.Add(entry.offset + sizeof(chunkHeader));
+			recording->chunkFirstRecords.Add(entry.firstRecord);
+			recording->numRecords += entry.numRecords;
+		}
+	}
+
+	if (!bIndexed)
+	{
+		recording->chunkOffsets.Reset();
+		recording->chunkFirstRecords.Reset();
+		recording->numRecords = 0;
+		recording->ScanChunks();
+		UE_LOG(LogTemp, Log, TEXT("The drive recording %s was not closed, %d records were recovered."), *fileName, recording->numRecords);
+	}
+	return recording;
+}
+
+bool FDriveRecording::ScanChunks()
+{
+	int64 offset = sizeof(FDriveRecordingFileHeader);
+	FDriveRecordingChunkHeader chunkHeader;
+	while (offset + (int64)sizeof(chunkHeader) <= file->Num())
+	{
+		FMemory::Memcpy(&chunkHeader, file->GetData() + offset, sizeof(chunkHeader));
+		int64 recordsOffset = offset + sizeof(chunkHeader);
+		if (chunkHeader.magic != FDriveRecordingChunkHeader::ChunkMagic || chunkHeader.numRecords <= 0
+			|| recordsOffset + (int64)chunkHeader.numRecords * recordSize > file->Num()
+			|| FCrc::MemCrc32(file->GetData() + recordsOffset, chunkHeader.numRecords * recordSize) != chunkHeader.checksum)
+		{
+			break;
+		}
+
+		chunkOffsets.Add(recordsOffset);
+		chunkFirstRecords.Add(numRecords);
+		numRecords += chunkHeader.numRecords;
+		offset = recordsOffset + (int64)chunkHeader.numRecords * recordSize;
+	}
+	return chunkOffsets.Num() > 0;
+}
+
+const uint8* FDriveRecording::FindRecord(int32 index) const
+{
+	check(index >= 0 && index < numRecords);
+
+	// Find the last chunk that starts at or before the record
+	int32 low = 0, high = chunkFirstRecords.Num() - 1;
+	while (low < high)
+	{
+		int32 middle = (low + high + 1) / 2;
+		if (chunkFirstRecords[middle] <= index)
+		{
+			low = middle;
+		}
+		else
+		{
+			high = middle - 1;
+		}
+	}
+	return file->GetData() + chunkOffsets[low] + (int64)(index - chunkFirstRecords[low]) * recordSize;
+}
+
+const FDriveRecord& FDriveRecording::GetRecord(int32 index) const
+{
+	return *(const FDriveRecord*)FindRecord(index);
+}
+
+const float* FDriveRecording::GetFeatures(int32 index) const
+{
+	return (const float*)(FindRecord(index) + sizeof(FDriveRecord));
+}
+
+bool FDriveRecording::GetMask(int32 index, FVisionMask& mask) const
+{
+	const uint8* data = FindRecord(index);
+	const FDriveRecord& record = *(const FDriveRecord*)data;
+	mask.Init(maskWidth, maskHeight);
+	mask.FrameId = record.FrameId;
+	if ((record.Flags & FDriveRecord::HasMask) == 0 || !HasMasks())
+	{
+		return false;
+	}
+	FMemory::Memcpy(mask.Words.GetData(), data + sizeof(FDriveRecord) + Align(numFeatures * (int32)sizeof(float), 8), mask.Words.Num() * sizeof(uint64));
+	return true;
+}
+
+void FDriveRecording::GetBatch(TArrayView<const int32> indices, int32 numOutputs, TArray<float>& inputs, TArray<float>& expectedOutputs) const
+{
+	numOutputs = FMath::Clamp(numOutputs, 0, 2);
+	inputs.SetNumUninitialized(indices.Num() * numFeatures);
+	expectedOutputs.SetNumUninitialized(indices.Num() * numOutputs);
+	for (int32 i = 0; i < indices.Num(); i++)
+	{
+		const uint8* data = FindRecord(indices[i]);
+		const FDriveRecord& record = *(const FDriveRecord*)data;
+		FMemory::Memcpy(inputs.GetData() + i * numFeatures, data + sizeof(FDriveRecord), numFeatures * sizeof(float));
+
+		float controls[2] = { record.Steering, record.Throttle };
+		for (int32 o = 0; o < numOutputs; o++)
+		{
+			expectedOutputs[i * numOutputs + o] = FMath::Clamp((controls[o] + 1.0f) * 0.5f, 0.0f, 1.0f);
+		}
+	}
+}
+
+float FDriveRecording::TrainEpoch(UNeuralNetwork* neuralNetwork, int32 batchSize, FRandomStream& random, int32 numThreads) const
+{
+	if (neuralNetwork == nullptr || numRecords == 0)
+	{
+		return -1.0f;
+	}
+	TArray<int> structure = neuralNetwork->GetStructure();
+	if (structure.Num() < 2 || structure[0] != numFeatures || structure.Last() > 2)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("A neural network with %d inputs and %d outputs can't be trained with a drive recording of %d features."),
+			structure.Num() > 0 ? structure[0] : 0, structure.Num() > 0 ? structure.Last() : 0, numFeatures);
+		return -1.0f;
+	}
+
+	// Shuffle the records, so the batches mix records from all over the drive
+	TArray<int32> order;
+	order.SetNumUninitialized(numRecords);
+	for (int32 i = 0; i < numRecords; i++)
+	{
+		order[i] = i;
+	}
+	for (int32 i = numRecords - 1; i > 0; i--)
+	{
+		order.Swap(i, random.RandRange(0, i));
+	}
+
+	batchSize = FMath::Max(batchSize, 1);
+	TArray<float> inputs, expectedOutputs;
+	float totalError = 0.0f;
+	int32 numBatches = 0;
+	for (int32 first = 0; first < numRecords; first += batchSize)
+	{
+		int32 size = FMath::Min(batchSize, numRecords - first);
+		GetBatch(TArrayView<const int32>(order.GetData() + first, size), structure.Last(), inputs, expectedOutputs);
+		totalError += neuralNetwork->TrainBatch(TArrayView<const float>(inputs), TArrayView<const float>(expectedOutputs), size, numThreads);
+		++numBatches;
+	}
+	return totalError / numBatches;
+}
+
+static void CheckDriveRecording()
+{
+	const int32 numRecords = 4000, numFeatures = 5;
+	FString fileName = FPaths::Combine(FPaths::GameSavedDir(), TEXT("Recordings"), TEXT("Check.vvdrec"));
+	FRandomStream random(1);
+
+	// Record random records, with a mask on every other one
+	TArray<FDriveRecord> records;
+	TArray<float> features;
+	TArray<FVisionMask> masks;
+	records.SetNum(numRecords);
+	features.SetNumUninitialized(numRecords * numFeatures);
+	masks.SetNum(numRecords);
+	for (int32 i = 0; i < numRecords; i++)
+	{
+		records[i].Time = i / 60.0f;
+		records[i].Speed = random.FRandRange(0.0f, 2500.0f);
+		records[i].Throttle = random.FRandRange(-1.0f, 1.0f);
+		records[i].Steering = random.FRandRange(-1.0f, 1.0f);
+		records[i].Reward = random.FRand();
+		records[i].FrameId = i;
+		for (int32 f = 0; f < numFeatures; f++)
+		{
+			features[i * numFeatures + f] = random.FRand();
+		}
+		masks[i].Init(i % 2 == 0 ? 48 : 32, 32);
+		for (int32 p = 0; p < masks[i].Num(); p++)
+		{
+			masks[i].Set(p, random.FRand() < 0.3f);
+		}
+	}
+
+	TUniquePtr<FDriveRecorder> recorder = FDriveRecorder::Create(fileName, numFeatures, 48, 32, numRecords);
+	if (!recorder.IsValid())
+	{
+		return;
+	}
+	double startTime = FPlatformTime::Seconds();
+	for (int32 i = 0; i < numRecords; i++)
+	{
+		recorder->Record(records[i], features.GetData() + i * numFeatures, &masks[i]);
+	}
+	double recordTime = FPlatformTime::Seconds() - startTime;
+	int32 numDropped = recorder->GetNumDropped();
+	startTime = FPlatformTime::Seconds();
+	recorder->Close();
+	double closeTime = FPlatformTime::Seconds() - startTime;
+
+	// Read them back
+	TSharedPtr<FDriveRecording, ESPMode::ThreadSafe> recording = FDriveRecording::Open(fileName);
+	if (!recording.IsValid())
+	{
+		return;
+	}
+	int32 numDifferent = 0;
+	FVisionMask mask;
+	for (int32 i = 0; i < recording->Num(); i++)
+	{
+		const FDriveRecord& record = recording->GetRecord(i);
+		bool bHasMask = recording->GetMask(i, mask);
+		bool bSame = FMemory::Memcmp(&record, &records[i], sizeof(FDriveRecord) - 2 * sizeof(uint32)) == 0
+			&& FMemory::Memcmp(recording->GetFeatures(i), features.GetData() + i * numFeatures, numFeatures * sizeof(float)) == 0
+			&& bHasMask == (i % 2 == 0) && (!bHasMask || mask == masks[i]);
+		numDifferent += !bSame;
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("Drive recording: %.3f us per record queued, %.3f ms to close, %d of %d records dropped, %d of %d records read back differ."),
+		recordTime * 1e6 / numRecords, closeTime * 1e3, numDropped, numRecords, numDifferent, recording->Num());
+
+	// A recording that wasn't closed loses its index and its last chunk
+	TArray<uint8> fileData;
+	if (FFileHelper::LoadFileToArray(fileData, *fileName))
+	{
+		FString truncatedFileName = FPaths::Combine(FPaths::GameSavedDir(), TEXT("Recordings"), TEXT("CheckTruncated.vvdrec"));
+		int64 recordSize = GetRecordSize(numFeatures, 48, 32);
+		fileData.SetNum(fileData.Num() - sizeof(FDriveRecordingFooter) - (numRecords + FDriveRecorder::RecordsPerChunk - 1) / FDriveRecorder::RecordsPerChunk * sizeof(FDriveRecordingIndexEntry) - recordSize / 2);
+		FFileHelper::SaveArrayToFile(fileData, *truncatedFileName);
+		TSharedPtr<FDriveRecording, ESPMode::ThreadSafe> truncated = FDriveRecording::Open(truncatedFileName);
+		int32 numRecovered = truncated.IsValid() ? truncated->Num() : 0;
+		UE_LOG(LogTemp, Display, TEXT("Drive recording without its index: %d of %d records recovered."), numRecovered, recording->Num());
+	}
+
+	// Train a NN on the recording
+	UNeuralNetwork* neuralNetwork = UNeuralNetwork::GetInstance();
+	neuralNetwork->Init(numFeatures, 2, TArray<int>({ 8 }), 0.1f, 0.001f, 1);
+	startTime = FPlatformTime::Seconds();
+	float error = recording->TrainEpoch(neuralNetwork, 32, random);
+	double trainTime = FPlatformTime::Seconds() - startTime;
+	UE_LOG(LogTemp, Display, TEXT("Drive recording: trained an epoch in %.3f ms (%.0f samples per second), mean error %g."),
+		trainTime * 1e3, recording->Num() / FMath::Max(trainTime, 1e-9), error);
+}
+
+static FAutoConsoleCommand CheckDriveRecordingCommand(
+	TEXT("VV.Recording.Check"),
+	TEXT("Records random drive records, checks that they are read back the same, also from a recording that wasn't closed, and trains a neural network on them."),
+	FConsoleCommandDelegate::CreateStatic(&CheckDriveRecording));
@@ -0,0 +1,186 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "Containers/CircularQueue.h"
+#include "HAL/Runnable.h"
+#include "VisionMask.h"
+
+class FMappedFile;
+class UNeuralNetwork;
+
+/* The fixed part of a record of a drive recording, for one tick of a vehicle.
+ *	It is followed by the features (float each), padded to 8 bytes, and by the words of the mask if the recording has masks. */
+struct FDriveRecord
+{
+	// The flag set when the record has a mask
+	static const uint32 HasMask = 1;
+
+	// The world time of the tick, in seconds
+	float Time = 0.0f;
+
+	// The forward speed of the vehicle, in centimeters per second
+	float Speed = 0.0f;
+
+	// The last throttle and steering inputs applied to the vehicle, between -1 and 1
+	float Throttle = 0.0f;
+	float Steering = 0.0f;
+
+	// The reward given to the vehicle since the previous record
+	float Reward = 0.0f;
+
+	// The capture frame of the feed the features were computed from
+	uint32 FrameId = 0;
+
+	// A combination of the flags above
+	uint32 Flags = 0;
+
+	uint32 Padding = 0;
+};
+
+/** Records the drive of a vehicle, one record per tick, into an append-only binary file that FDriveRecording reads.
+ *		The file starts with a header giving the number of features and the mask size, followed by chunks of records,
+ *		each with a small header and checksum, and ends with an index of the chunks written when the recorder is closed.
+ *		Records are copied into preallocated slots passed to a writer thread through lock-free queues, so Record never
+ *		allocates, blocks or touches the file. When the writer falls behind and no slot is free, the record is dropped.
+ */
+class VISIONVEHICLES_API FDriveRecorder : public FRunnable
+{
+public:
+	// The largest number of records written to the file at once
+	static const int32 RecordsPerChunk = 256;
+
+	// The time after which the records waiting in the chunk being written are written, in seconds
+	static const double ChunkFlushTime;
+
+	/* Creates the file and starts the writer thread. The masks are recorded if the mask size is not 0.
+	 *	The number of slots is rounded up to a power of two. Returns null if the file can't be created. */
+	static TUniquePtr<FDriveRecorder> Create(const FString& fileName, int32 numFeatures, int32 maskWidth, int32 maskHeight, int32 numSlots = 1024);
+
+	virtual ~FDriveRecorder();
+
+	/* Queues a record with the given features, which must have the number of features of the recording, and the given mask.
+	 *	The mask is only recorded if it has the mask size of the recording. Returns false if the record was dropped. */
+	bool Record(const FDriveRecord& record, const float* features, const FVisionMask* mask = nullptr);
+
+	// Writes the queued records and the index, and closes the file. Nothing can be recorded afterwards.
+	void Close();
+
+	// Returns the number of records queued, and the number dropped because the queue was full
+	FORCEINLINE int32 GetNumRecorded() const { return numRecorded; }
+	FORCEINLINE int32 GetNumDropped() const { return numDropped; }
+
+	// Begin FRunnable interface
+	virtual uint32 Run() override;
+	virtual void Stop() override;
+	// End FRunnable interface
+
+private:
+	FDriveRecorder(int32 _numFeatures, int32 _maskWidth, int32 _maskHeight, int32 _numSlots);
+
+	// Moves the queued records into the current chunk, writing it whenever it is full. Returns whether any record was moved.
+	bool WriteQueuedRecords();
+
+	// Writes the records of the current chunk to the file
+	void WriteChunk();
+
+	// The file the recording is written to, only used by the writer thread once it is started
+	TUniquePtr<FArchive> writer;
+
+	// The number of features, the mask size and the size of each record in bytes
+	int32 numFeatures;
+	int32 maskWidth;
+	int32 maskHeight;
+	int32 recordSize;
+
+	// The preallocated slots records are copied into
+	TArray<uint8> slots;
+
+	// The indices of the slots filled by Record and waiting to be written, and of the slots free to be filled
+	TCircularQueue<int32> queuedSlots;
+	TCircularQueue<int32> freeSlots;
+
+	// The records of the chunk being written, their number, and the time the last chunk was written at
+	TArray<uint8> chunk;
+	int32 numChunkRecords;
+	double lastChunkTime;
+
+	// The offset in the file and the number of records of each chunk written so far
+	TArray<int64> chunkOffsets;
+	TArray<int32> chunkRecords;
+
+	// The thread that writes the file, and the event that wakes it up
+	FRunnableThread* thread;
+	FEvent* wakeEvent;
+
+	// Set to make the writer thread write everything and exit
+	FThreadSafeBool bStopping;
+
+	// The number of records queued and dropped by Record
+	int32 numRecorded;
+	int32 numDropped;
+};
+
+/** A drive recording written by FDriveRecorder, memory-mapped and read in place.
+ *		A recording that wasn't closed, for example because the game crashed, has no index. Its chunks are found by
+ *		scanning the file and checking their checksums, and reading stops at the first incomplete chunk.
+ */
+class VISIONVEHICLES_API FDriveRecording
+{
+public:
+	// Opens the recording in the given file. Returns null if it can't be opened or is not a drive recording.
+	static TSharedPtr<FDriveRecording, ESPMode::ThreadSafe> Open(const FString& fileName);
+
+	// Returns the number of records
+	FORCEINLINE int32 Num() const { return numRecords; }
+
+	// Returns the number of features of each record
+	FORCEINLINE int32 GetNumFeatures() const { return numFeatures; }
+
+	// Returns whether the records have masks, and their size
+	FORCEINLINE bool HasMasks() const { return maskWidth > 0 && maskHeight > 0; }
+	FORCEINLINE FIntPoint GetMaskSize() const { return FIntPoint(maskWidth, maskHeight); }
+
+	// Returns the fixed part of the given record
+	const FDriveRecord& GetRecord(int32 index) const;
+
+	// Returns the features of the given record
+	const float* GetFeatures(int32 index) const;
+
+	// Reads the mask of the given record. Returns false if it has none, in which case the mask is empty.
+	bool GetMask(int32 index, FVisionMask& mask) const;
+
+	/* Gets the inputs and expected outputs of the NN for the given records, row-major, as TrainBatch takes them.
+	 *	The inputs are the features, and the expected outputs are the steering then the throttle, mapped to [0, 1]
+	 *	like the sigmoid outputs of the NN, of which the first 'numOutputs' are used. */
+	void GetBatch(TArrayView<const int32> indices, int32 numOutputs, TArray<float>& inputs, TArray<float>& expectedOutputs) const;
+
+	/* Trains the NN with every record once, in shuffled mini-batches of the given size.
+	 *	The NN must have as many inputs as there are features, and at most 2 outputs. Returns the mean error of the batches, or -1 on failure. */
+	float TrainEpoch(UNeuralNetwork* neuralNetwork, int32 batchSize, FRandomStream& random, int32 numThreads = 4) const;
+
+private:
+	FDriveRecording();
+
+	// Finds the chunks of a recording without an index. Returns whether any chunk was found.
+	bool ScanChunks();
+
+	// Returns the record with the given index
+	const uint8* FindRecord(int32 index) const;
+
+	// The mapped file
+	TSharedPtr<FMappedFile, ESPMode::ThreadSafe> file;
+
+	// The number of features, the mask size and the size of each record in bytes
+	int32 numFeatures;
+	int32 maskWidth;
+	int32 maskHeight;
+	int32 recordSize;
+
+	// The offset in the file of the records of each chunk, and the index of the first record of each chunk
+	TArray<int64> chunkOffsets;
+	TArray<int32> chunkFirstRecords;
+
+	// The number of records
+	int32 numRecords;
+};
@@ -0,0 +1,332 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "VisionVehicles.h"
+#include "ExperienceReplay.h"
+#include "NeuralNetwork.h"
+
+// The buffers shared by groups of pawns, by group
+static TMap<FName, TWeakPtr<FExperienceReplay, ESPMode::ThreadSafe>> SharedExperienceReplays;
+
+// All the buffers, for the stats
+static TArray<FExperienceReplay*> AllExperienceReplays;
+
+TSharedPtr<FExperienceReplay, ESPMode::ThreadSafe> FExperienceReplay::Create(FName group, UNeuralNetwork* neuralNetwork, const FSettings& settings)
+{
+	if (neuralNetwork == nullptr || neuralNetwork->GetStructure().Num() < 2 || neuralNetwork->GetPrecision() != ENeuralNetworkPrecision::Float32)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Experience replay needs a neural network that is initialized and not quantized."));
+		return nullptr;
+	}
+
+	TArray<int> structure = neuralNetwork->GetStructure();
+	if (!group.IsNone())
+	{
+		TSharedPtr<FExperienceReplay, ESPMode::ThreadSafe> shared = SharedExperienceReplays.FindRef(group).Pin();
+		if (shared.IsValid() && shared->numInputs == structure[0] && shared->numOutputs == structure.Last())
+		{
+			return shared;
+		}
+		if (shared.IsValid())
+		{
+			UE_LOG(LogTemp, Warning, TEXT("The experience replay group %s has samples of other dimensions, a separate buffer is used."), *group.ToString());
+		}
+	}
+
+	TSharedPtr<FExperienceReplay, ESPMode::ThreadSafe> replay = MakeShareable(new FExperienceReplay(neuralNetwork, settings));
+	if (!group.IsNone() && !SharedExperienceReplays.FindRef(group).IsValid())
+	{
+		replay->group = group;
+		SharedExperienceReplays.Add(group, replay);
+	}
+	return replay;
+}
+
+FExperienceReplay::FExperienceReplay(UNeuralNetwork* neuralNetwork, const FSettings& _settings)
+{
+	settings = _settings;
+	settings.Capacity = FMath::Max(settings.Capacity, 1);
+	settings.BatchSize = FMath::Clamp(settings.BatchSize, 1, settings.Capacity);
+	settings.BatchesPerRound = FMath::Max(settings.BatchesPerRound, 1);
+
+	TArray<int> structure = neuralNetwork->GetStructure();
+	numInputs = structure[0];
+	numOutputs = structure.Last();
+
+	// Allocate everything up front, so pushing and training never allocate
+	inputs.SetNumZeroed(settings.Capacity * numInputs);
+	expectedOutputs.SetNumZeroed(settings.Capacity * numOutputs);
+	numSamples = 0;
+	nextSample = 0;
+
+	int32 stagingCapacity = FMath::Clamp(settings.Capacity / 4, 64, 4096);
+	stagedInputs.SetNumZeroed(stagingCapacity * numInputs);
+	stagedExpectedOutputs.SetNumZeroed(stagingCapacity * numOutputs);
+	numStaged = 0;
+
+	learner = UNeuralNetwork::GetSharedInstance(neuralNetwork);
+	published = UNeuralNetwork::GetSharedInstance(neuralNetwork);
+	publishedVersion = 0;
+	updateFrame = GFrameNumber - 1;
+
+	random.Initialize(FPlatformTime::Cycles());
+	order.Reserve(settings.Capacity);
+	orderPosition = 0;
+	batchIndices.SetNumZeroed(settings.BatchSize);
+	batchInputs.SetNumZeroed(settings.BatchSize * numInputs);
+	batchExpectedOutputs.SetNumZeroed(settings.BatchSize * numOutputs);
+	roundSamples = 0;
+	roundTime = 0.0;
+
+	pushedSamples = 0;
+	droppedSamples = 0;
+	trainedSamples = 0;
+	currentPushed = 0;
+	currentTrained = 0;
+	currentTrainingTime = 0.0;
+	numStatsFrames = 0;
+	nextStatsFrame = 0;
+
+	AllExperienceReplays.Add(this);
+}
+
+FExperienceReplay::~FExperienceReplay()
+{
+	if (task.IsValid())
+	{
+		// Only wait for the batch being trained, not the rest of the round
+		bCancelled = true;
+		FTaskGraphInterface::Get().WaitUntilTaskCompletes(task);
+	}
+	if (!group.IsNone())
+	{
+		SharedExperienceReplays.Remove(group);
+	}
+	AllExperienceReplays.Remove(this);
+}
+
+bool FExperienceReplay::Push(const float* sampleInputs, const float* sampleExpectedOutputs)
+{
+	++pushedSamples;
+	++currentPushed;
+
+	// While the task is training, the ring can't be written
+	if (!task.IsValid())
+	{
+		WriteSample(sampleInputs, sampleExpectedOutputs);
+		return true;
+	}
+	if (numStaged * numInputs == stagedInputs.Num())
+	{
+		++droppedSamples;
+		return false;
+	}
+	FMemory::Memcpy(stagedInputs.GetData() + numStaged * numInputs, sampleInputs, numInputs * sizeof(float));
+	FMemory::Memcpy(stagedExpectedOutputs.GetData() + numStaged * numOutputs, sampleExpectedOutputs, numOutputs * sizeof(float));
+	++numStaged;
+	return true;
+}
+
+void FExperienceReplay::WriteSample(const float* sampleInputs, const float* sampleExpectedOutputs)
+{
+	FMemory::Memcpy(inputs.GetData() + nextSample * numInputs, sampleInputs, numInputs * sizeof(float));
+	FMemory::Memcpy(expectedOutputs.GetData() + nextSample * numOutputs, sampleExpectedOutputs, numOutputs * sizeof(float));
+	nextSample = (nextSample + 1) % settings.Capacity;
+	numSamples = FMath::Min(numSamples + 1, settings.Capacity);
+}
+
+void FExperienceReplay::Update()
+{
+	if (updateFrame == GFrameNumber)
+	{
+		return;
+	}
+	updateFrame = GFrameNumber;
+
+	// Close the stats of the previous frame
+	framePushed[nextStatsFrame] = currentPushed;
+	frameTrained[nextStatsFrame] = currentTrained;
+	frameTimes[nextStatsFrame] = FApp::GetDeltaTime();
+	frameTrainingTimes[nextStatsFrame] = currentTrainingTime;
+	nextStatsFrame = (nextStatsFrame + 1) % StatsFrames;
+	numStatsFrames = FMath::Min(numStatsFrames + 1, StatsFrames);
+	currentPushed = 0;
+	currentTrained = 0;
+	currentTrainingTime = 0.0;
+
+	if (task.IsValid())
+	{
+		if (!task->IsComplete())
+		{
+			return;
+		}
+
+		// Publish the weights of the round. The learner copies them when it trains again.
+		task.SafeRelease();
+		trainedSamples += roundSamples;
+		currentTrained += roundSamples;
+		currentTrainingTime += roundTime;
+		published->ShareWeightsFrom(learner);
+		++publishedVersion;
+	}
+
+	// Move the samples pushed during the round into the ring
+	for (int32 s = 0; s < numStaged; s++)
+	{
+		WriteSample(stagedInputs.GetData() + s * numInputs, stagedExpectedOutputs.GetData() + s * numOutputs);
+	}
+	numStaged = 0;
+
+	if (numSamples < settings.BatchSize)
+	{
+		return;
+	}
+	int32 sampleCount = numSamples, newestSample = (nextSample + settings.Capacity - 1) % settings.Capacity;
+	task = FFunctionGraphTask::CreateAndDispatchWhenReady([this, sampleCount, newestSample]()
+	{
+		TrainRound(sampleCount, newestSample);
+	}, TStatId(), nullptr, ENamedThreads::AnyThread);
+}
+
+bool FExperienceReplay::PullWeights(UNeuralNetwork* neuralNetwork, uint32& version) const
+{
+	if (neuralNetwork == nullptr || version == publishedVersion)
+	{
+		return false;
+	}
+	neuralNetwork->ShareWeightsFrom(published);
+	version = publishedVersion;
+	return true;
+}
+
+void FExperienceReplay::TrainRound(int32 sampleCount, int32 newestSample)
+{
+	double roundStartTime = FPlatformTime::Seconds();
+	int32 numBatches = 0;
+	for (; numBatches < settings.BatchesPerRound && !bCancelled; numBatches++)
+	{
+		SampleBatch(sampleCount, newestSample);
+
+		// Gather the rows of the batch, and train with them on this thread only
+		for (int32 i = 0; i < settings.BatchSize; i++)
+		{
+			FMemory::Memcpy(batchInputs.GetData() + i * numInputs, inputs.GetData() + batchIndices[i] * numInputs, numInputs * sizeof(float));
+			FMemory::Memcpy(batchExpectedOutputs.GetData() + i * numOutputs, expectedOutputs.GetData() + batchIndices[i] * numOutputs, numOutputs * sizeof(float));
+		}
+		learner->TrainBatch(TArrayView<const float>(batchInputs), TArrayView<const float>(batchExpectedOutputs), settings.BatchSize, 1);
+	}
+	roundSamples = numBatches * settings.BatchSize;
+	roundTime = FPlatformTime::Seconds() - roundStartTime;
+}
+
+void FExperienceReplay::SampleBatch(int32 sampleCount, int32 newestSample)
+{
+	for (int32 i = 0; i < settings.BatchSize; i++)
+	{
+		switch (settings.Sampling)
+		{
+		case EExperienceSampling::Uniform:
+			batchIndices[i] = random.RandRange(0, sampleCount - 1);
+			break;
+
+		case EExperienceSampling::Shuffled:
+			// Start a new pass over the samples in the ring when the last one is done
+			if (orderPosition >= order.Num())
+			{
+				order.SetNumUninitialized(sampleCount, false);
+				for (int32 s = 0; s < sampleCount; s++)
+				{
+					order[s] = s;
+				}
+				for (int32 s = sampleCount - 1; s > 0; s--)
+				{
+					order.Swap(s, random.RandRange(0, s));
+				}
+				orderPosition = 0;
+			}
+			batchIndices[i] = order[orderPosition++];
+			break;
+
+		case EExperienceSampling::Recent:
+		{
+			// One minus the square root of a uniform number has a density decreasing linearly from 0 to 1, so older samples are drawn less
+			float age = 1.0f - FMath::Sqrt(random.GetFraction());
+			int32 offset = FMath::Min((int32)(age * sampleCount), sampleCount - 1);
+			batchIndices[i] = (newestSample - offset + settings.Capacity) % settings.Capacity;
+			break;
+		}
+		}
+	}
+}
+
+FExperienceReplay::FStats FExperienceReplay::GetStats() const
+{
+	FStats stats;
+	stats.NumSamples = numSamples;
+	stats.Capacity = settings.Capacity;
+	stats.PushedSamples = pushedSamples;
+	stats.DroppedSamples = droppedSamples;
+	stats.TrainedSamples = trainedSamples;
+	if (numStatsFrames == 0)
+	{
+		return stats;
+	}
+
+	double totalPushed = 0.0, totalTrained = 0.0, totalFrameTime = 0.0, totalTrainingTime = 0.0;
+	for (int32 i = 0; i < numStatsFrames; i++)
+	{
+		totalPushed += framePushed[i];
+		totalTrained += frameTrained[i];
+		totalFrameTime += frameTimes[i];
+		totalTrainingTime += frameTrainingTimes[i];
+	}
+	if (totalFrameTime > 0.0)
+	{
+		stats.PushedPerSecond = (float)(totalPushed / totalFrameTime);
+		stats.TrainedPerSecond = (float)(totalTrained / totalFrameTime);
+	}
+	stats.AverageFrameTime = (float)(totalFrameTime * 1000.0 / numStatsFrames);
+	stats.TrainingTimePerFrame = (float)(totalTrainingTime * 1000.0 / numStatsFrames);
+	return stats;
+}
+
+void FExperienceReplay::AddReferencedObjects(FReferenceCollector& Collector)
+{
+	Collector.AddReferencedObject(learner);
+	Collector.AddReferencedObject(published);
+}
+
+bool FExperienceReplay::IsTrainingInBackground(const UNeuralNetwork* neuralNetwork)
+{
+	for (const FExperienceReplay* replay : AllExperienceReplays)
+	{
+		// The task is only released by Update, after it is complete, so the learner is not touched while it is held
+		if (replay->learner == neuralNetwork && replay->task.IsValid())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+void FExperienceReplay::LogStats()
+{
+	for (const FExperienceReplay* replay : AllExperienceReplays)
+	{
+		FStats stats = replay->GetStats();
+		UE_LOG(LogTemp, Display, TEXT("Experience replay %s: %d of %d samples, %lld pushed (%.1f/s, %lld dropped), %lld trained (%.1f/s, %.2f per pushed sample)"),
+			replay->group.IsNone() ? TEXT("(not shared)") : *replay->group.ToString(), stats.NumSamples, stats.Capacity,
+			stats.PushedSamples, stats.PushedPerSecond, stats.DroppedSamples, stats.TrainedSamples, stats.TrainedPerSecond,
+			stats.PushedSamples > 0 ? (float)stats.TrainedSamples / stats.PushedSamples : 0.0f);
+		UE_LOG(LogTemp, Display, TEXT("    frame time %.3f ms, background training %.3f ms per frame (rates and times over the last %d frames)"),
+			stats.AverageFrameTime, stats.TrainingTimePerFrame, StatsFrames);
+	}
+	if (AllExperienceReplays.Num() == 0)
+	{
+		UE_LOG(LogTemp, Display, TEXT("There are no experience replay buffers."));
+	}
+}
+
+static FAutoConsoleCommand LogExperienceReplayStatsCommand(
+	TEXT("VV.NN.ReplayStats"),
+	TEXT("Logs how many samples each experience replay buffer holds and trains per second, against the game frame time."),
+	FConsoleCommandDelegate::CreateStatic(&FExperienceReplay::LogStats));
@@ -0,0 +1,181 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "UObject/GCObject.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "ExperienceReplay.generated.h"
+
+class UNeuralNetwork;
+
+/* How the samples of the mini-batches are drawn from an experience replay buffer. */
+UENUM(BlueprintType)
+enum class EExperienceSampling : uint8
+{
+	// Each sample is drawn uniformly from the buffer, with replacement
+	Uniform,
+	// The batches walk the buffer in a shuffled order, so each sample is used once per pass
+	Shuffled,
+	// Each sample is drawn with a probability that decreases linearly with its age, favoring the latest driving
+	Recent
+};
+
+/** A fixed-capacity ring buffer of training samples, from which a background task trains a neural network with mini-batches.
+ *		The inputs and expected outputs of all the samples are stored in two preallocated arrays, one row per sample.
+ *		The game thread only pushes samples. Once per frame, when the previous round of training is done, Update publishes
+ *		the trained weights, moves the samples pushed meanwhile from a staging area into the ring, and starts a new round.
+ *		So the task never reads memory the game thread writes, and neither waits for the other.
+ *		The task trains a copy of the NN, whose weights are shared with the NNs of the pawns when they are published,
+ *		and only copied when the next round changes them. It is only used from the game thread, besides its task.
+ *		While a round is in flight, the game thread must not read the learner either, since the task replaces its weights
+ *		and grows its buffers. Code that visits every NN, like VV.NN.MemReport, skips the NNs IsTrainingInBackground returns true for.
+ */
+class VISIONVEHICLES_API FExperienceReplay : public FGCObject
+{
+public:
+	// The settings of a buffer
+	struct FSettings
+	{
+		int32 Capacity = 16384;
+		EExperienceSampling Sampling = EExperienceSampling::Shuffled;
+		int32 BatchSize = 32;
+		int32 BatchesPerRound = 4;
+	};
+
+	// The number of frames the rates and times of the stats are computed over
+	static const int32 StatsFrames = 64;
+
+	// The training stats of a buffer
+	struct FStats
+	{
+		// The samples in the buffer, and the samples pushed, dropped and trained since it was created
+		int32 NumSamples = 0;
+		int32 Capacity = 0;
+		int64 PushedSamples = 0;
+		int64 DroppedSamples = 0;
+		int64 TrainedSamples = 0;
+
+		// The samples pushed and trained per second of game time over the last StatsFrames frames
+		float PushedPerSecond = 0.0f;
+		float TrainedPerSecond = 0.0f;
+
+		// The game frame time, and the time the background task spent training per frame over the last StatsFrames frames, in milliseconds
+		float AverageFrameTime = 0.0f;
+		float TrainingTimePerFrame = 0.0f;
+	};
+
+	/* Creates a buffer that trains a copy of the given NN, or returns the buffer of the group if it is not none and
+	 *	there is one already with the same dimensions, in which case the settings are the ones it was created with.
+	 *	Returns null if the NN can't be trained. */
+	static TSharedPtr<FExperienceReplay, ESPMode::ThreadSafe> Create(FName group, UNeuralNetwork* neuralNetwork, const FSettings& settings);
+
+	// Logs the stats of every buffer
+	static void LogStats();
+
+	// Returns whether the given NN is the learner of a buffer whose background task may be training it
+	static bool IsTrainingInBackground(const UNeuralNetwork* neuralNetwork);
+
+	virtual ~FExperienceReplay();
+
+	/* Adds a sample, replacing the oldest one when the buffer is full. The inputs and outputs must have the dimensions of the NN.
+	 *	Returns false if it was dropped, because the staging area was full while the task was training. */
+	bool Push(const float* inputs, const float* expectedOutputs);
+
+	/* Publishes the weights trained by the last round, and starts the next one, if it is done. It only does anything once per frame,
+	 *	so it can be called by all the pawns that share the buffer. */
+	void Update();
+
+	/* Makes the given NN share the last published weights, if they changed since the version given, which is updated.
+	 *	Returns whether they changed. */
+	bool PullWeights(UNeuralNetwork* neuralNetwork, uint32& version) const;
+
+	// Returns the number of inputs and outputs of the samples
+	FORCEINLINE int32 GetNumInputs() const { return numInputs; }
+	FORCEINLINE int32 GetNumOutputs() const { return numOutputs; }
+
+	// Returns the training stats
+	FStats GetStats() const;
+
+	// Begin FGCObject interface
+	virtual void AddReferencedObjects(FReferenceCollector& Collector) override;
+	// End FGCObject interface
+
+private:
+	FExperienceReplay(UNeuralNetwork* neuralNetwork, const FSettings& _settings);
+
+	// Writes a sample into the ring, replacing the oldest one when it is full
+	void WriteSample(const float* sampleInputs, const float* sampleExpectedOutputs);
+
+	// Trains the learner with the batches of a round, stopping early if the buffer is being destroyed. Runs in the background task.
+	void TrainRound(int32 sampleCount, int32 newestSample);
+
+	// Draws the ring indices of the samples of a batch. Runs in the background task.
+	void SampleBatch(int32 sampleCount, int32 newestSample);
+
+	// The settings the buffer was created with
+	FSettings settings;
+
+	// The group of the buffer, or none if it isn't shared
+	FName group;
+
+	// The number of inputs and outputs of each sample
+	int32 numInputs;
+	int32 numOutputs;
+
+	// The inputs and expected outputs of the samples in the ring, row-major
+	TArray<float> inputs;
+	TArray<float> expectedOutputs;
+
+	// The number of samples in the ring, and the index the next one is written at
+	int32 numSamples;
+	int32 nextSample;
+
+	// The samples pushed while the task is training, and their number
+	TArray<float> stagedInputs;
+	TArray<float> stagedExpectedOutputs;
+	int32 numStaged;
+
+	// The NN trained by the task, and the NN holding the last weights published to the pawns
+	UNeuralNetwork* learner;
+	UNeuralNetwork* published;
+	uint32 publishedVersion;
+
+	// The task training the current round, if any
+	FGraphEventRef task;
+
+	// Set when the buffer is destroyed, so the task stops after the batch it is training
+	FThreadSafeBool bCancelled;
+
+	// The last frame Update ran in
+	uint32 updateFrame;
+
+	// Used by the task: the random stream, the shuffled order of the ring and the position in it, and the batch being trained
+	FRandomStream random;
+	TArray<int32> order;
+	int32 orderPosition;
+	TArray<int32> batchIndices;
+	TArray<float> batchInputs;
+	TArray<float> batchExpectedOutputs;
+
+	// Written by the task, and read by the game thread when it is done: the samples trained and the time spent in the last round
+	int32 roundSamples;
+	double roundTime;
+
+	// The totals for the stats
+	int64 pushedSamples;
+	int64 droppedSamples;
+	int64 trainedSamples;
+
+	// The samples pushed and trained, and the training time, in the current frame
+	int32 currentPushed;
+	int32 currentTrained;
+	double currentTrainingTime;
+
+	// The samples pushed and trained, the frame time and the training time of the last frames, in a ring of StatsFrames entries
+	int32 framePushed[StatsFrames];
+	int32 frameTrained[StatsFrames];
+	double frameTimes[StatsFrames];
+	double frameTrainingTimes[StatsFrames];
+	int32 numStatsFrames;
+	int32 nextStatsFrame;
+};
@@ -0,0 +1,92 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "VisionVehicles.h"
+#include "MappedFile.h"
+
+#if PLATFORM_WINDOWS
+#include "AllowWindowsPlatformTypes.h"
+#include <windows.h>
+#include "HideWindowsPlatformTypes.h"
+#elif PLATFORM_LINUX || PLATFORM_MAC
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+FMappedFile::FMappedFile()
+{
+	data = nullptr;
+	size = 0;
+#if PLATFORM_WINDOWS
+	fileHandle = nullptr;
+	mappingHandle = nullptr;
+#endif
+}
+
+FMappedFile::~FMappedFile()
+{
+	if (IsMapped() && data != nullptr)
+	{
+#if PLATFORM_WINDOWS
+		UnmapViewOfFile(data);
+		CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+#elif PLATFORM_LINUX || PLATFORM_MAC
+		munmap(const_cast<uint8*>(data), size);
+#endif
+	}
+}
+
+TSharedPtr<FMappedFile, ESPMode::ThreadSafe> FMappedFile::Open(const FString& fileName)
+{
+	TSharedPtr<FMappedFile, ESPMode::ThreadSafe> file = MakeShareable(new FMappedFile());
+	FString fullFileName = FPaths::ConvertRelativePathToFull(fileName);
+
+#if PLATFORM_WINDOWS
+	HANDLE fileHandle = CreateFileW(*fullFileName, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER fileSize;
+		HANDLE mappingHandle = GetFileSizeEx(fileHandle, &fileSize) && fileSize.QuadPart > 0 ? CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+		void* view = mappingHandle != nullptr ? MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (view != nullptr)
+		{
+			file->fileHandle = fileHandle;
+			file->mappingHandle = mappingHandle;
+			file->data = (const uint8*)view;
+			file->size = fileSize.QuadPart;
+			return file;
+		}
+
+		if (mappingHandle != nullptr)
+		{
+			CloseHandle(mappingHandle);
+		}
+		CloseHandle(fileHandle);
+	}
+#elif PLATFORM_LINUX || PLATFORM_MAC
+	int fileDescriptor = open(TCHAR_TO_UTF8(*fullFileName), O_RDONLY);
+	if (fileDescriptor >= 0)
+	{
+		struct stat fileStat;
+		void* view = fstat(fileDescriptor, &fileStat) == 0 && fileStat.st_size > 0 ? mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0) : MAP_FAILED;
+		close(fileDescriptor); // The mapping stays valid after closing the file
+		if (view != MAP_FAILED)
+		{
+			file->data = (const uint8*)view;
+			file->size = fileStat.st_size;
+			return file;
+		}
+	}
+#endif
+
+	// Memory mapping is not available or failed, so read the whole file
+	if (!FFileHelper::LoadFileToArray(file->fallbackData, *fullFileName, FILEREAD_Silent) || file->fallbackData.Num() == 0)
+	{
+		return nullptr;
+	}
+	file->data = file->fallbackData.GetData();
+	file->size = file->fallbackData.Num();
+	return file;
+}
@@ -0,0 +1,45 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+/** A read-only view of the whole contents of a file.
+ *		The file is memory-mapped on Windows, Linux and Mac, so its contents are paged in on demand and never copied.
+ *		On other platforms the file is read into memory instead.
+ *		The file can be replaced by moving another file over it while it is mapped, which doesn't change the mapped contents,
+ *		but it must not be written in place.
+ */
+class VISIONVEHICLES_API FMappedFile
+{
+public:
+	// Opens the given file. Returns null if it can't be opened or is empty.
+	static TSharedPtr<FMappedFile, ESPMode::ThreadSafe> Open(const FString& fileName);
+
+	~FMappedFile();
+
+	// Returns the contents of the file
+	FORCEINLINE const uint8* GetData() const { return data; }
+
+	// Returns the size of the file in bytes
+	FORCEINLINE int64 Num() const { return size; }
+
+	// Returns whether the file is memory-mapped, or was read into memory
+	FORCEINLINE bool IsMapped() const { return fallbackData.Num() == 0; }
+
+private:
+	FMappedFile();
+
+	// The contents of the file
+	const uint8* data;
+
+	// The size of the file in bytes
+	int64 size;
+
+	// The contents of the file, when it could not be memory-mapped
+	TArray<uint8> fallbackData;
+
+#if PLATFORM_WINDOWS
+	// The handles of the file and of its mapping
+	void* fileHandle;
+	void* mappingHandle;
+#endif
+};
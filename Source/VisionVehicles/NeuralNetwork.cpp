@@ -2,11 +2,59 @@
 
 #include "VisionVehicles.h"
 #include "NeuralNetwork.h"
+#include "MappedFile.h"
+#include "ExperienceReplay.h"
+#include "Async/ParallelFor.h"
+
+/* The header of a neural network file. It is followed by the dimension of each layer (int32 each),
+ *	and then by the weights (float each) at 'weightsOffset', which is aligned to 16 bytes so the weights can be used in place.
+ *	The values are stored in the byte order of the machine that wrote the file, so the weights can be used without conversion.
+ *	A file written with the other byte order is recognized by its swapped magic number, and rejected. */
+struct FNeuralNetworkFileHeader
+{
+	// The identifier of neural network files
+	static const uint32 FileMagic = 0x4E4E5656; // "VVNN"
+
+	// The current version of the format
+	static const uint32 FileVersion = 1;
+
+	uint32 magic;
+	uint32 version;
+	int32 numDimensions;
+	int32 numWeights;
+	uint32 weightsOffset;
+	uint32 weightsChecksum; // CRC32 of the weights
+	float learningRate;
+	float initialLearningRate;
+	float learningRateDecay;
+	int32 epoche;
+};
+
+/* A neural network file that has been loaded, so NNs loading the same file can share its weights. */
+struct FLoadedNeuralNetworkFile
+{
+	// The time stamp of the file when it was loaded
+	FDateTime timeStamp;
+
+	// The header of the file
+	FNeuralNetworkFileHeader header;
+
+	// The dimensions of the NN in the file
+	TArray<int> dimensions;
+
+	// The weights of the file, while any NN uses them
+	TWeakPtr<FNeuralNetworkWeights, ESPMode::ThreadSafe> weights;
+};
+
+// The neural network files that have been loaded, by full file name
+static TMap<FString, FLoadedNeuralNetworkFile> LoadedNeuralNetworkFiles;
 
 
 UNeuralNetwork::UNeuralNetwork()
 {
-
+	nInputs = 0;
+	nOutputs = 0;
+	trainingSamplesPerSecond = 0.0f;
 }
 
 UNeuralNetwork* UNeuralNetwork::GetInstance()
@@ -14,36 +62,124 @@ UNeuralNetwork* UNeuralNetwork::GetInstance()
 	return NewObject<UNeuralNetwork>();
 }
 
-void UNeuralNetwork::Init(int inputs, int outputs, TArray<int> hiddenLayers, 
-	float _initialLearningRate, float _learningRateDecay)
+UNeuralNetwork* UNeuralNetwork::GetSharedInstance(UNeuralNetwork* source)
 {
-	// Set dimensions
-	nInputs = inputs;
-	nOutputs = outputs;
-	nHiddenLayers = hiddenLayers;
+	UNeuralNetwork* neuralNetwork = NewObject<UNeuralNetwork>();
+	neuralNetwork->ShareWeightsFrom(source);
+	return neuralNetwork;
+}
 
-	TArray<int> dimensions;
-	dimensions.Add(nInputs);
-	dimensions.Append(nHiddenLayers);
-	dimensions.Add(nOutputs);
+void UNeuralNetwork::ShareWeightsFrom(const UNeuralNetwork* source)
+{
+	if (source == nullptr || source->dimensions.Num() == 0)
+	{
+		return;
+	}
+	if (dimensions != source->dimensions)
+	{
+		SetDimensions(source->dimensions);
+	}
+	weights = source->weights;
+	quantizedWeights = source->quantizedWeights;
+	epoche = source->epoche;
+	initialLearningRate = source->initialLearningRate;
+	learningRateDecay = source->learningRateDecay;
+	learningRate = source->learningRate;
+}
 
-	// Initialize weights
-	weights.Empty();
-	for (int l = 1; l < dimensions.Num(); l++)
+void UNeuralNetwork::LogMemoryReport()
+{
+	int numNetworks = 0, numSkipped = 0;
+	int64 referencedBytes = 0, weightsBytes = 0, mappedBytes = 0, quantizedBytes = 0, scratchBytes = 0;
+	TSet<const void*> countedWeights;
+	for (TObjectIterator<UNeuralNetwork> it; it; ++it)
 	{
-		TArray<TArray<float>> layer; // The weights for the current layer
+		const UNeuralNetwork* neuralNetwork = *it;
+
+		// An NN being trained by an experience replay task can't be read, its buffers may be replaced meanwhile
+		if (FExperienceReplay::IsTrainingInBackground(neuralNetwork))
+		{
+			++numSkipped;
+			continue;
+		}
 
-		for (int j = 0; j < dimensions[l]; j++)
+		const FNeuralNetworkScratch* scratches[] = { &neuralNetwork->scratch, &neuralNetwork->batchScratch };
+		for (const FNeuralNetworkScratch* networkScratch : scratches)
 		{
-			TArray<float> w; // The weights for the current unit
-			for (int i = 0; i < dimensions[l - 1] + 1; i++) // +1: include the weight for the bias
+			scratchBytes += networkScratch->weightedSums.GetAllocatedSize() + networkScratch->activations.GetAllocatedSize()
+				+ networkScratch->deltas.GetAllocatedSize() + networkScratch->rowBuffer.GetAllocatedSize();
+		}
+		for (const FNeuralNetworkTrainingWorker& worker : neuralNetwork->trainingWorkers)
+		{
+			scratchBytes += worker.scratch.weightedSums.GetAllocatedSize() + worker.scratch.activations.GetAllocatedSize()
+				+ worker.scratch.deltas.GetAllocatedSize() + worker.scratch.rowBuffer.GetAllocatedSize() + worker.gradients.GetAllocatedSize();
+		}
+
+		if (neuralNetwork->quantizedWeights.IsValid())
+		{
+			++numNetworks;
+			const FNeuralNetworkQuantizedWeights* w = neuralNetwork->quantizedWeights.Get();
+			referencedBytes += w->GetAllocatedSize();
+			if (!countedWeights.Contains(w))
 			{
-				w.Add(FMath::RandRange(-1.0f, 1.0f));
+				countedWeights.Add(w);
+				quantizedBytes += w->GetAllocatedSize();
 			}
-			layer.Add(w);
+			continue;
+		}
+		if (!neuralNetwork->weights.IsValid())
+		{
+			continue;
 		}
+		++numNetworks;
 
-		weights.Add(layer);
+		const FNeuralNetworkWeights* w = neuralNetwork->weights.Get();
+		int64 bytes = w->Num() * sizeof(float);
+		referencedBytes += bytes;
+		if (!countedWeights.Contains(w))
+		{
+			countedWeights.Add(w);
+			if (w->IsReadOnly())
+			{
+				mappedBytes += bytes;
+			}
+			else
+			{
+				weightsBytes += bytes;
+			}
+		}
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("%d neural networks use %d weight buffers: %.1f KB of heap weights, %.1f KB of mapped weights and %.1f KB of quantized weights, instead of %.1f KB without sharing. Scratch buffers: %.1f KB."),
+		numNetworks, countedWeights.Num(), weightsBytes / 1024.0f, mappedBytes / 1024.0f, quantizedBytes / 1024.0f, referencedBytes / 1024.0f, scratchBytes / 1024.0f);
+	if (numSkipped > 0)
+	{
+		UE_LOG(LogTemp, Display, TEXT("%d neural networks being trained by experience replay tasks are not counted."), numSkipped);
+	}
+}
+
+static FAutoConsoleCommand MemoryReportCommand(
+	TEXT("VV.NN.MemReport"),
+	TEXT("Logs the memory used by all the neural networks, and how much of it is saved by sharing weights."),
+	FConsoleCommandDelegate::CreateStatic(&UNeuralNetwork::LogMemoryReport));
+
+void UNeuralNetwork::Init(int inputs, int outputs, TArray<int> hiddenLayers, 
+	float _initialLearningRate, float _learningRateDecay, int _seed)
+{
+	// Set dimensions
+	TArray<int> _dimensions;
+	_dimensions.Add(inputs);
+	_dimensions.Append(hiddenLayers);
+	_dimensions.Add(outputs);
+	int numWeights = SetDimensions(_dimensions);
+
+	// Initialize weights
+	FRandomStream randomStream(_seed);
+	weights = MakeShareable(new FNeuralNetworkWeights(numWeights));
+	float* w = weights->GetMutableData();
+	for (int i = 0; i < numWeights; i++)
+	{
+		w[i] = _seed != 0 ? randomStream.FRandRange(-1.0f, 1.0f) : FMath::RandRange(-1.0f, 1.0f);
 	}
 
 	// Set learning rate
@@ -53,199 +189,606 @@ void UNeuralNetwork::Init(int inputs, int outputs, TArray<int> hiddenLayers,
 	learningRate = initialLearningRate;
 }
 
-TArray<float> UNeuralNetwork::Run(TArray<float> inputs, TArray<TArray<float>>* weightedSums, TArray<TArray<float>>* activations)
+int UNeuralNetwork::SetDimensions(const TArray<int>& _dimensions)
 {
-	weightedSums->Empty();
-	activations->Empty();
+	dimensions = _dimensions;
+	nInputs = dimensions[0];
+	nOutputs = dimensions.Last();
+	nHiddenLayers.Empty();
+	for (int l = 1; l < dimensions.Num() - 1; l++)
+	{
+		nHiddenLayers.Add(dimensions[l]);
+	}
 
-	// Initialize the first layer with the input values
-	activations->Add(inputs);
-	
-	// Feed forward the activation values
-	for (int l = 0; l < weights.Num(); l++)
+	// Compute the offset of each layer in the weights buffer
+	weightOffsets.Empty();
+	int numWeights = 0;
+	for (int l = 1; l < dimensions.Num(); l++)
 	{
-		TArray<float> ws; // The weighted sum for each unit in this layer
-		TArray<float> a; // The activation for each unit in this layer
+		weightOffsets.Add(numWeights);
+		numWeights += dimensions[l] * (dimensions[l - 1] + 1); // +1: include the weight for the bias
+	}
 
-		TArray<float> prevActivation = (*activations)[l]; // The activations of the previous layer
-		prevActivation.Add(1.0f); // Add the extra value for the bias
-		for (int j = 0; j < weights[l].Num(); j++)
-		{
-			float z = Dot(prevActivation, weights[l][j]);
-			ws.Add(z);
-			a.Add(Sigmoid(z));
-		}
+	quantizedWeights.Reset();
 
-		weightedSums->Add(ws);
-		activations->Add(a);
+	// Compute the offset of each layer in the scratch buffers and allocate them
+	unitOffsets.Empty();
+	int numUnits = 0;
+	for (int l = 0; l < dimensions.Num(); l++)
+	{
+		unitOffsets.Add(numUnits);
+		numUnits += dimensions[l];
 	}
+	AllocateScratch(scratch);
+	batchScratch = FNeuralNetworkScratch();
+	trainingWorkers.Empty();
 
-	// Return the output values
-	return (*activations).Top();
+	return numWeights;
 }
 
-TArray<float> UNeuralNetwork::Run(TArray<float> inputs)
+void UNeuralNetwork::MakeWeightsWritable()
 {
-	TArray<TArray<float>> weightedSums, activations;
-	return Run(inputs, &weightedSums, &activations);
+	if (weights->IsReadOnly() || !weights.IsUnique())
+	{
+		weights = weights->Copy();
+	}
 }
 
-float UNeuralNetwork::Train(TArray<float> inputs, TArray<float> expectedOutputs)
+void UNeuralNetwork::AllocateScratch(FNeuralNetworkScratch& _scratch, int batchSize) const
 {
-	// Run the NN and get the resulted output
-	TArray<TArray<float>> weightedSums, activations;
-	TArray<float> outputs = Run(inputs, &weightedSums, &activations);
+	int numUnits = unitOffsets.Num() > 0 ? unitOffsets.Last() + dimensions.Last() : 0;
+	_scratch.batchSize = batchSize;
+	_scratch.weightedSums.SetNumZeroed(numUnits * batchSize);
+	_scratch.activations.SetNumZeroed(numUnits * batchSize);
+	_scratch.deltas.SetNumZeroed(numUnits * batchSize);
+	_scratch.rowBuffer.SetNumZeroed(FMath::Max(dimensions) + 1);
+}
 
-	// The deltas for each unit in each layer (how a change in its value affects a change in the error)
-	// Note: the layers are in reverse order, i.e. the output layer has index 0
-	TArray<TArray<float>> deltas;
+void UNeuralNetwork::FeedForward(const float* inputs, FNeuralNetworkScratch& _scratch) const
+{
+	// Initialize the first layer with the input values
+	FMemory::Memcpy(_scratch.activations.GetData(), inputs, nInputs * sizeof(float));
 
-	// Compute the deltas for the last layer
-	TArray<float> outputSigmoidPrimes;
-	for (float value : weightedSums.Top()) outputSigmoidPrimes.Add(SigmoidPrime(value));
-	deltas.Add(Multiply(Difference(activations.Top(), expectedOutputs), outputSigmoidPrimes));
+	// Feed forward the activation values
+	for (int l = 0; l < NumLayers(); l++)
+	{
+		const float* prevActivation = GetLayerValues(_scratch.activations, l); // The activations of the previous layer
+		float* ws = _scratch.weightedSums.GetData() + unitOffsets[l + 1]; // The weighted sum for each unit in this layer
+		float* a = _scratch.activations.GetData() + unitOffsets[l + 1]; // The activation for each unit in this layer
+		if (quantizedWeights.IsValid())
+		{
+			FeedForwardQuantizedLayer(l, 1, prevActivation, ws, a, _scratch);
+		}
+		else
+		{
+			FNeuralNetworkKernels::ForwardLayer(GetLayerWeights(l), dimensions[l + 1], dimensions[l], prevActivation, ws, a);
+		}
+	}
+}
 
-	// Compute the deltas for each layer backwards: backpropagation
-	for (int l = weights.Num() - 2; l >= 0; l--)
+bool UNeuralNetwork::Run(TArrayView<const float> inputs, TArrayView<float> outputs)
+{
+	if (!CheckInitialized(TEXT("run")))
+	{
+		return false;
+	}
+	if (inputs.Num() != nInputs || outputs.Num() != nOutputs)
 	{
-		TArray<TArray<float>> nextLayerWeightsT = Transpose(weights[l+1]);
+		UE_LOG(LogTemp, Warning, TEXT("Trying to run the neural network with wrong dimensions: %d inputs - %d outputs."), inputs.Num(), outputs.Num());
+		return false;
+	}
+
+	FeedForward(inputs.GetData(), scratch);
+
+	// Copy the output values
+	FMemory::Memcpy(outputs.GetData(), GetLayerValues(scratch.activations, dimensions.Num() - 1), nOutputs * sizeof(float));
+	return true;
+}
+
+void UNeuralNetwork::FeedForwardBatch(const float* inputs, int batchSize, FNeuralNetworkScratch& _scratch) const
+{
+	// Initialize the first layer with the input values
+	FMemory::Memcpy(_scratch.activations.GetData(), inputs, batchSize * nInputs * sizeof(float));
 
-		TArray<float> d;
-		for (int i = 0; i < weights[l].Num(); i++)
+	// Feed forward the activation values
+	for (int l = 0; l < NumLayers(); l++)
+	{
+		const float* prevActivations = _scratch.activations.GetData() + unitOffsets[l] * batchSize;
+		float* ws = _scratch.weightedSums.GetData() + unitOffsets[l + 1] * batchSize;
+		float* a = _scratch.activations.GetData() + unitOffsets[l + 1] * batchSize;
+		if (quantizedWeights.IsValid())
+		{
+			FeedForwardQuantizedLayer(l, batchSize, prevActivations, ws, a, _scratch);
+		}
+		else
 		{
-			d.Add(Dot(nextLayerWeightsT[i], deltas.Top()) * SigmoidPrime(weightedSums[l][i]));
+			FNeuralNetworkKernels::ForwardLayerBatch(GetLayerWeights(l), dimensions[l + 1], dimensions[l], batchSize, prevActivations, ws, a);
 		}
-		deltas.Add(d);
 	}
+}
 
-	// Reverse deltas so they can use in the same order as weights
-	deltas = Reverse(deltas);
+void UNeuralNetwork::FeedForwardQuantizedLayer(int layer, int batchSize, const float* prevActivations, float* weightedSums, float* activations, FNeuralNetworkScratch& _scratch) const
+{
+	int units = dimensions[layer + 1];
+	int inputs = dimensions[layer];
+	float scale = quantizedWeights->IsFloat16() ? 1.0f : quantizedWeights->GetScale(layer);
+	float zeroPoint = quantizedWeights->IsFloat16() ? 0.0f : quantizedWeights->GetZeroPoint(layer);
 
-	// Alter the weights in each layer
-	for (int l = 0; l < weights.Num(); l++)
+	// A single input vector is run directly on the 8-bit weights
+	if (batchSize == 1 && !quantizedWeights->IsFloat16())
 	{
-		for (int j = 0; j < weights[l].Num(); j++)
+		const uint8* layerWeights = quantizedWeights->GetInt8Data() + weightOffsets[layer];
+		FNeuralNetworkKernels::ForwardLayerInt8(layerWeights, units, inputs, scale, zeroPoint, prevActivations, weightedSums, activations);
+		return;
+	}
+
+	// Otherwise each row of weights is converted once and used for the whole batch
+	float* row = _scratch.rowBuffer.GetData();
+	for (int j = 0; j < units; j++)
+	{
+		int rowOffset = weightOffsets[layer] + j * (inputs + 1);
+		if (quantizedWeights->IsFloat16())
 		{
-			// Adjust the weight for each connection
-			for (int i = 0; i < weights[l][j].Num() - 1; i++)
-			{
-				weights[l][j][i] -= deltas[l][j] * activations[l][i] * learningRate;
-			}
-			
-			// Adjust the weight for the bias
-			weights[l][j][weights[l][j].Num() - 1] -= deltas[l][j] * learningRate;
+			FNeuralNetworkKernels::DequantizeFloat16(quantizedWeights->GetFloat16Data() + rowOffset, inputs + 1, row);
+		}
+		else
+		{
+			FNeuralNetworkKernels::DequantizeInt8(quantizedWeights->GetInt8Data() + rowOffset, inputs + 1, scale, zeroPoint, row);
 		}
+		FNeuralNetworkKernels::ForwardUnitBatch(row, j, units, inputs, batchSize, prevActivations, weightedSums);
 	}
+	FNeuralNetworkKernels::Sigmoid(weightedSums, activations, units * batchSize);
+}
 
-	// Update the learning rate
-	learningRate = initialLearningRate / (1.0f + learningRateDecay * ++epoche);
+bool UNeuralNetwork::RunBatch(TArrayView<const float> inputs, int batchSize, TArrayView<float> outputs)
+{
+	if (!CheckInitialized(TEXT("run")))
+	{
+		return false;
+	}
+	if (batchSize <= 0 || inputs.Num() != batchSize * nInputs || outputs.Num() != batchSize * nOutputs)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Trying to run a batch of %d elements in the neural network with wrong dimensions: %d inputs - %d outputs."), batchSize, inputs.Num(), outputs.Num());
+		return false;
+	}
 
-	// Calculate the error made
-	return ComputeError(expectedOutputs, outputs);
+	if (batchScratch.batchSize < batchSize)
+	{
+		AllocateScratch(batchScratch, batchSize);
+	}
+	FeedForwardBatch(inputs.GetData(), batchSize, batchScratch);
+
+	// Copy the output values
+	const float* outputActivations = batchScratch.activations.GetData() + unitOffsets.Last() * batchSize;
+	FMemory::Memcpy(outputs.GetData(), outputActivations, batchSize * nOutputs * sizeof(float));
+	return true;
 }
 
-TArray<int> UNeuralNetwork::GetStructure()
+TArray<float> UNeuralNetwork::RunBatch(const TArray<float>& inputs, int batchSize)
 {
-     TArray<int> result;
-     result.Add(nInputs);
-     for (int i = 0; i<nHiddenLayers.Num(); i++)
-          result.Add(nHiddenLayers[i]); 
-     result.Add(nOutputs);
-     return result;
+	TArray<float> outputs;
+	outputs.SetNumUninitialized(FMath::Max(batchSize, 0) * nOutputs);
+	if (!RunBatch(inputs, batchSize, outputs))
+	{
+		outputs.Empty();
+	}
+	return outputs;
 }
 
-float UNeuralNetwork::GetWeight(int _layerId, int _fromInd, int _toInd)
+TArray<float> UNeuralNetwork::Run(const TArray<float>& inputs)
 {
-     return weights[_layerId][_fromInd][_toInd];
+	TArray<float> outputs;
+	outputs.SetNumUninitialized(nOutputs);
+	if (!Run(inputs, outputs))
+	{
+		outputs.Empty();
+	}
+	return outputs;
 }
 
+float UNeuralNetwork::Train(const TArray<float>& inputs, const TArray<float>& expectedOutputs)
+{
+	if (!CheckInitialized(TEXT("train")))
+	{
+		return 0.0f;
+	}
+	if (inputs.Num() != nInputs || expectedOutputs.Num() != nOutputs)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Trying to train the neural network with wrong dimensions: %d inputs - %d outputs."), inputs.Num(), expectedOutputs.Num());
+		return 0.0f;
+	}
+	if (CheckQuantized(TEXT("train")))
+	{
+		return 0.0f;
+	}
+
+	// Run the NN and compute the deltas for each unit
+	FeedForward(inputs.GetData(), scratch);
+	float error = Backpropagate(expectedOutputs.GetData(), scratch);
+	MakeWeightsWritable();
+
+	// Alter the weights in each layer
+	for (int l = 0; l < NumLayers(); l++)
+	{
+		const float* d = GetLayerValues(scratch.deltas, l + 1);
+		FNeuralNetworkKernels::AddOuterProduct(GetMutableLayerWeights(l), dimensions[l + 1], dimensions[l], d, GetLayerValues(scratch.activations, l), -learningRate);
+	}
+
+	// Update the learning rate
+	learningRate = initialLearningRate / (1.0f + learningRateDecay * ++epoche);
+
+	return error;
+}
 
-// ------ AUXILIARY MATHEMATICAL METHODS ------
+float UNeuralNetwork::TrainBatch(const TArray<float>& inputs, const TArray<float>& expectedOutputs, int batchSize, int numThreads)
+{
+	return TrainBatch(TArrayView<const float>(inputs), TArrayView<const float>(expectedOutputs), batchSize, numThreads);
+}
 
-float UNeuralNetwork::Dot(const TArray<float>& a, const TArray<float>& b) const
+float UNeuralNetwork::TrainBatch(TArrayView<const float> inputs, TArrayView<const float> expectedOutputs, int batchSize, int numThreads)
 {
-	if (a.Num() != b.Num())
+	if (!CheckInitialized(TEXT("train")))
+	{
+		return 0.0f;
+	}
+	if (batchSize <= 0 || inputs.Num() != batchSize * nInputs || expectedOutputs.Num() != batchSize * nOutputs)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Trying to train the neural network with a batch of %d elements with wrong dimensions: %d inputs - %d outputs."), batchSize, inputs.Num(), expectedOutputs.Num());
+		return 0.0f;
+	}
+	if (CheckQuantized(TEXT("train")))
 	{
-		UE_LOG(LogTemp, Warning, TEXT("Trying to dot product two vectors with non-equal dimensions: %d - %d."), a.Num(), b.Num());
 		return 0.0f;
 	}
 
-	float value = 0.0f;
-	for (int i = 0; i < a.Num(); i++)
+	double startTime = FPlatformTime::Seconds();
+
+	// Make sure there is storage for each thread
+	int numChunks = FMath::Clamp(numThreads, 1, batchSize);
+	while (trainingWorkers.Num() < numChunks)
+	{
+		FNeuralNetworkTrainingWorker& worker = trainingWorkers[trainingWorkers.AddDefaulted()];
+		AllocateScratch(worker.scratch);
+		worker.gradients.SetNumZeroed(weights->Num());
+	}
+
+	// Accumulate the gradients of each chunk of the batch in parallel
+	ParallelFor(numChunks, [&](int32 chunk)
+	{
+		FNeuralNetworkTrainingWorker& worker = trainingWorkers[chunk];
+		FMemory::Memzero(worker.gradients.GetData(), worker.gradients.Num() * sizeof(float));
+		worker.error = 0.0f;
+
+		int first = chunk * batchSize / numChunks;
+		int last = (chunk + 1) * batchSize / numChunks;
+		for (int b = first; b < last; b++)
+		{
+			FeedForward(inputs.GetData() + b * nInputs, worker.scratch);
+			worker.error += Backpropagate(expectedOutputs.GetData() + b * nOutputs, worker.scratch);
+
+			for (int l = 0; l < NumLayers(); l++)
+			{
+				const float* d = GetLayerValues(worker.scratch.deltas, l + 1);
+				float* layerGradients = worker.gradients.GetData() + weightOffsets[l];
+				FNeuralNetworkKernels::AddOuterProduct(layerGradients, dimensions[l + 1], dimensions[l], d, GetLayerValues(worker.scratch.activations, l), 1.0f);
+			}
+		}
+	}, numChunks == 1);
+
+	// Reduce the gradients of all chunks, always in the same order, and apply them
+	float error = trainingWorkers[0].error;
+	float* gradients = trainingWorkers[0].gradients.GetData();
+	for (int chunk = 1; chunk < numChunks; chunk++)
+	{
+		const float* chunkGradients = trainingWorkers[chunk].gradients.GetData();
+		for (int i = 0; i < weights->Num(); i++)
+		{
+			gradients[i] += chunkGradients[i];
+		}
+		error += trainingWorkers[chunk].error;
+	}
+
+	MakeWeightsWritable();
+	float* w = weights->GetMutableData();
+	float scale = -learningRate / batchSize;
+	for (int i = 0; i < weights->Num(); i++)
 	{
-		value += a[i] * b[i];
+		w[i] += gradients[i] * scale;
 	}
-	return value;
+
+	// Update the learning rate
+	learningRate = initialLearningRate / (1.0f + learningRateDecay * ++epoche);
+
+	double elapsedTime = FPlatformTime::Seconds() - startTime;
+	trainingSamplesPerSecond = elapsedTime > 0.0 ? (float)(batchSize / elapsedTime) : 0.0f;
+
+	return error / batchSize;
 }
 
-float UNeuralNetwork::ComputeError(const TArray<float>& a, const TArray<float>& b) const
+float UNeuralNetwork::Backpropagate(const float* expectedOutputs, FNeuralNetworkScratch& _scratch) const
 {
-	if (a.Num() != b.Num())
+	// Compute the deltas for the last layer
+	int outputLayer = dimensions.Num() - 1;
+	const float* outputs = GetLayerValues(_scratch.activations, outputLayer);
+	float* outputDeltas = _scratch.deltas.GetData() + unitOffsets[outputLayer];
+	float error = 0.0f;
+	for (int j = 0; j < nOutputs; j++)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("Trying to compare two vectors with non-equal dimensions: %d - %d."), a.Num(), b.Num());
-		return 0.0f;
+		float difference = outputs[j] - expectedOutputs[j];
+		outputDeltas[j] = difference * SigmoidPrimeFromActivation(outputs[j]);
+		error += difference * difference;
 	}
 
-	float value = 0.0f;
-	for (int i = 0; i < a.Num(); i++)
+	// Compute the deltas for each layer backwards: backpropagation
+	//	The weights of the next layer are read in their own layout, and the deltas are written in place in forward order.
+	for (int l = NumLayers() - 2; l >= 0; l--)
 	{
-		value += (a[i] - b[i]) * (a[i] - b[i]);
+		const float* nextDeltas = GetLayerValues(_scratch.deltas, l + 2);
+		const float* a = GetLayerValues(_scratch.activations, l + 1);
+		float* d = _scratch.deltas.GetData() + unitOffsets[l + 1];
+		FNeuralNetworkKernels::MultiplyTransposed(GetLayerWeights(l + 1), dimensions[l + 2], dimensions[l + 1], nextDeltas, d);
+		for (int i = 0; i < dimensions[l + 1]; i++)
+		{
+			d[i] *= SigmoidPrimeFromActivation(a[i]);
+		}
 	}
-	return value * 0.5f;
+
+	// Calculate the error made
+	return error * 0.5f;
 }
 
-TArray<float> UNeuralNetwork::Difference(const TArray<float>& a, const TArray<float>& b) const
+bool UNeuralNetwork::SaveToFile(const FString& fileName) const
 {
-	if (a.Num() != b.Num())
+	if (CheckQuantized(TEXT("save")))
 	{
-		UE_LOG(LogTemp, Warning, TEXT("Trying to compute the difference of two vectors with non-equal dimensions: %d - %d."), a.Num(), b.Num());
+		return false;
 	}
+	if (!weights.IsValid())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Trying to save a neural network that has not been initialized."));
+		return false;
+	}
+
+	FNeuralNetworkFileHeader header;
+	header.magic = FNeuralNetworkFileHeader::FileMagic;
+	header.version = FNeuralNetworkFileHeader::FileVersion;
+	header.numDimensions = dimensions.Num();
+	header.numWeights = weights->Num();
+	header.weightsOffset = Align(sizeof(FNeuralNetworkFileHeader) + dimensions.Num() * sizeof(int32), 16);
+	header.weightsChecksum = FCrc::MemCrc32(weights->GetData(), weights->Num() * sizeof(float));
+	header.learningRate = learningRate;
+	header.initialLearningRate = initialLearningRate;
+	header.learningRateDecay = learningRateDecay;
+	header.epoche = epoche;
+
+	TArray<uint8> fileData;
+	fileData.AddZeroed(header.weightsOffset + weights->Num() * sizeof(float));
+	FMemory::Memcpy(fileData.GetData(), &header, sizeof(header));
+	for (int l = 0; l < dimensions.Num(); l++)
+	{
+		int32 dimension = dimensions[l];
+		FMemory::Memcpy(fileData.GetData() + sizeof(header) + l * sizeof(int32), &dimension, sizeof(int32));
+	}
+	FMemory::Memcpy(fileData.GetData() + header.weightsOffset, weights->GetData(), weights->Num() * sizeof(float));
 
-	TArray<float> diff;
-	for (int i = 0; i < FMath::Min(a.Num(), b.Num()); i++)
+	// Write a new file and move it over the old one, which NNs loaded from it may still have mapped
+	FString fullFileName = FPaths::ConvertRelativePathToFull(FPaths::GameDir(), fileName);
+	FString tempFileName = fullFileName + TEXT(".tmp");
+	if (!FFileHelper::SaveArrayToFile(fileData, *tempFileName))
 	{
-		diff.Add(a[i] - b[i]);
+		UE_LOG(LogTemp, Warning, TEXT("Could not write the neural network file %s."), *tempFileName);
+		return false;
 	}
-	return diff;
+	if (!IFileManager::Get().Move(*fullFileName, *tempFileName, true, true))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not replace the neural network file %s."), *fullFileName);
+		IFileManager::Get().Delete(*tempFileName);
+		return false;
+	}
+
+	// The NNs loaded from the old file keep using its weights, but new ones load the new file
+	LoadedNeuralNetworkFiles.Remove(fullFileName);
+	return true;
 }
 
-TArray<float> UNeuralNetwork::Multiply(const TArray<float>& a, const TArray<float>& b) const
+bool UNeuralNetwork::LoadFromFile(const FString& fileName)
 {
-	if (a.Num() != b.Num())
+	FString fullFileName = FPaths::ConvertRelativePathToFull(FPaths::GameDir(), fileName);
+	FDateTime timeStamp = IFileManager::Get().GetTimeStamp(*fullFileName);
+
+	// Share the weights of the file if another NN is using them already
+	FLoadedNeuralNetworkFile* loadedFile = LoadedNeuralNetworkFiles.Find(fullFileName);
+	TSharedPtr<FNeuralNetworkWeights, ESPMode::ThreadSafe> loadedWeights = loadedFile != nullptr ? loadedFile->weights.Pin() : nullptr;
+	if (loadedWeights.IsValid() && loadedFile->timeStamp == timeStamp)
+	{
+		SetDimensions(loadedFile->dimensions);
+		weights = loadedWeights;
+		epoche = loadedFile->header.epoche;
+		initialLearningRate = loadedFile->header.initialLearningRate;
+		learningRateDecay = loadedFile->header.learningRateDecay;
+		learningRate = loadedFile->header.learningRate;
+		return true;
+	}
+
+	TSharedPtr<FMappedFile, ESPMode::ThreadSafe> file = FMappedFile::Open(fullFileName);
+	if (!file.IsValid())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not open the neural network file %s."), *fullFileName);
+		return false;
+	}
+
+	// Validate the header
+	FNeuralNetworkFileHeader header;
+	if (file->Num() < (int64)sizeof(header))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("The neural network file %s is truncated."), *fullFileName);
+		return false;
+	}
+	FMemory::Memcpy(&header, file->GetData(), sizeof(header));
+	if (header.magic == BYTESWAP_ORDER32(FNeuralNetworkFileHeader::FileMagic))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("The neural network file %s was written with another byte order."), *fullFileName);
+		return false;
+	}
+	if (header.magic != FNeuralNetworkFileHeader::FileMagic || header.version != FNeuralNetworkFileHeader::FileVersion)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("The file %s is not a neural network file of version %d."), *fullFileName, FNeuralNetworkFileHeader::FileVersion);
+		return false;
+	}
+	// The sizes are computed in 64 bits, so huge values in a corrupt header can't overflow past the checks
+	if (header.numDimensions < 2 || header.numWeights <= 0 || header.weightsOffset % 16 != 0
+		|| (int64)header.weightsOffset < (int64)sizeof(header) + (int64)header.numDimensions * (int64)sizeof(int32)
+		|| file->Num() < (int64)header.weightsOffset + (int64)header.numWeights * (int64)sizeof(float))
+	{
+		UE_LOG(LogTemp, Warning, TEXT("The neural network file %s is truncated or corrupt."), *fullFileName);
+		return false;
+	}
+
+	// Validate the dimensions against the number of weights, which fit in the file. The count is checked after each layer,
+	//	so it can't overflow either.
+	TArray<int> _dimensions;
+	int64 expectedWeights = 0;
+	for (int l = 0; l < header.numDimensions; l++)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("Trying to multiply two vectors with non-equal dimensions: %d - %d."), a.Num(), b.Num());
+		int32 dimension;
+		FMemory::Memcpy(&dimension, file->GetData() + sizeof(header) + l * sizeof(int32), sizeof(int32));
+		if (dimension <= 0)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("The neural network file %s has an invalid dimension for layer %d."), *fullFileName, l);
+			return false;
+		}
+		if (l > 0)
+		{
+			expectedWeights += (int64)dimension * ((int64)_dimensions.Last() + 1);
+			if (expectedWeights > header.numWeights)
+			{
+				UE_LOG(LogTemp, Warning, TEXT("The neural network file %s has more weights in its layers than it holds."), *fullFileName);
+				return false;
+			}
+		}
+		_dimensions.Add(dimension);
 	}
 
-	TArray<float> mult;
-	for (int i = 0; i < FMath::Min(a.Num(), b.Num()); i++)
+	const float* fileWeights = (const float*)(file->GetData() + header.weightsOffset);
+	if (expectedWeights != header.numWeights || FCrc::MemCrc32(fileWeights, header.numWeights * sizeof(float)) != header.weightsChecksum)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("The weights in the neural network file %s are corrupt."), *fullFileName);
+		return false;
+	}
+
+	// Use the weights in place from the file
+	SetDimensions(_dimensions);
+	weights = MakeShareable(new FNeuralNetworkWeights(file, fileWeights, header.numWeights));
+
+	// Set learning rate
+	epoche = header.epoche;
+	initialLearningRate = header.initialLearningRate;
+	learningRateDecay = header.learningRateDecay;
+	learningRate = header.learningRate;
+
+	// Remember the file so other NNs can share its weights
+	FLoadedNeuralNetworkFile& newLoadedFile = LoadedNeuralNetworkFiles.FindOrAdd(fullFileName);
+	newLoadedFile.timeStamp = timeStamp;
+	newLoadedFile.header = header;
+	newLoadedFile.dimensions = _dimensions;
+	newLoadedFile.weights = weights;
+
+	return true;
+}
+
+TArray<int> UNeuralNetwork::GetStructure()
+{
+	return dimensions;
+}
+
+float UNeuralNetwork::GetWeight(int _layerId, int _fromInd, int _toInd)
+{
+	int index = _fromInd * (dimensions[_layerId] + 1) + _toInd;
+	if (quantizedWeights.IsValid())
 	{
-		mult.Add(a[i] * b[i]);
+		return quantizedWeights->GetWeight(_layerId, weightOffsets[_layerId] + index);
 	}
-	return mult;
+	return GetLayerWeights(_layerId)[index];
 }
 
-TArray<TArray<float>> UNeuralNetwork::Transpose(const TArray<TArray<float>>& a) const
+float UNeuralNetwork::Quantize(ENeuralNetworkPrecision precision, const TArray<float>& recordedInputs)
 {
-	TArray<TArray<float>> t;
-	for (int i = 0; i < a[0].Num(); i++)
+	if (!weights.IsValid())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Trying to quantize a neural network that has not been initialized or is already quantized."));
+		return -1.0f;
+	}
+	if (precision == ENeuralNetworkPrecision::Float32)
+	{
+		return 0.0f;
+	}
+
+	if (recordedInputs.Num() % nInputs != 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Trying to quantize the neural network with %d recorded input values, which is not a multiple of its %d inputs."), recordedInputs.Num(), nInputs);
+		return -1.0f;
+	}
+
+	// Run the recorded inputs with the float weights
+	int numRecordedInputs = recordedInputs.Num() / nInputs;
+	TArrayView<const float> inputs(recordedInputs.GetData(), numRecordedInputs * nInputs);
+	TArray<float> referenceOutputs, outputs;
+	referenceOutputs.SetNumUninitialized(numRecordedInputs * nOutputs);
+	outputs.SetNumUninitialized(numRecordedInputs * nOutputs);
+	if (numRecordedInputs > 0)
+	{
+		RunBatch(inputs, numRecordedInputs, referenceOutputs);
+	}
+
+	// Quantize the weights and release the float ones
+	int64 floatBytes = weights->Num() * sizeof(float);
+	quantizedWeights = precision == ENeuralNetworkPrecision::Int8
+		? FNeuralNetworkQuantizedWeights::QuantizeToInt8(*weights, weightOffsets)
+		: FNeuralNetworkQuantizedWeights::ConvertToFloat16(*weights);
+	weights.Reset();
+
+	// Compare the outputs of the recorded inputs with the quantized weights
+	float maxError = 0.0f;
+	if (numRecordedInputs > 0)
 	{
-		TArray<float> x;
-		for (int j = 0; j < a.Num(); j++)
+		RunBatch(inputs, numRecordedInputs, outputs);
+		for (int i = 0; i < outputs.Num(); i++)
 		{
-			x.Add(a[j][i]);
+			maxError = FMath::Max(maxError, FMath::Abs(outputs[i] - referenceOutputs[i]));
 		}
-		t.Add(x);
 	}
-	return t;
+
+	UE_LOG(LogTemp, Log, TEXT("Quantized neural network to %s: weights use %lld bytes instead of %lld, maximum output error %g over %d recorded inputs."),
+		precision == ENeuralNetworkPrecision::Int8 ? TEXT("8 bits") : TEXT("half precision"), quantizedWeights->GetAllocatedSize(), floatBytes, maxError, numRecordedInputs);
+	return maxError;
 }
 
-template<typename T>
-TArray<T> UNeuralNetwork::Reverse(const TArray<T>& a) const
+ENeuralNetworkPrecision UNeuralNetwork::GetPrecision() const
 {
-	TArray<T> result;
-	for (int i = a.Num() - 1; i >= 0; i--)
+	if (quantizedWeights.IsValid())
 	{
-		result.Add(a[i]);
+		return quantizedWeights->IsFloat16() ? ENeuralNetworkPrecision::Float16 : ENeuralNetworkPrecision::Int8;
 	}
-	return result;
+	return ENeuralNetworkPrecision::Float32;
 }
+
+bool UNeuralNetwork::CheckInitialized(const TCHAR* operation) const
+{
+	if (dimensions.Num() == 0)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Trying to %s a neural network that hasn't been initialized."), operation);
+		return false;
+	}
+	return true;
+}
+
+bool UNeuralNetwork::CheckQuantized(const TCHAR* operation) const
+{
+	if (quantizedWeights.IsValid())
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Trying to %s a quantized neural network, which can only be run."), operation);
+		return true;
+	}
+	return false;
+}
+
@@ -3,8 +3,54 @@
 #pragma once
 
 #include "UObject/NoExportTypes.h"
+#include "Containers/ArrayView.h"
+#include "NeuralNetworkKernels.h"
+#include "NeuralNetworkWeights.h"
 #include "NeuralNetwork.generated.h"
 
+/* Scratch storage used when running the neural network.
+ *	The values for every layer are stored contiguously, at the offsets given by the unit offsets of the network.
+ *	When running a batch, the offsets are multiplied by the batch size, and each layer stores one row per batch element. */
+struct FNeuralNetworkScratch
+{
+	// The number of batch elements the buffers have room for
+	int batchSize = 0;
+
+	// The weighted sum for each unit in each layer
+	TArray<float, TAlignedHeapAllocator<16>> weightedSums;
+
+	// The activation for each unit in each layer, including the input layer
+	TArray<float, TAlignedHeapAllocator<16>> activations;
+
+	// The delta for each unit in each layer (how a change in its value affects a change in the error)
+	TArray<float, TAlignedHeapAllocator<16>> deltas;
+
+	// A row of weights converted from their quantized representation
+	TArray<float, TAlignedHeapAllocator<16>> rowBuffer;
+};
+
+/* The precision used to store the weights of a neural network. */
+UENUM(BlueprintType)
+enum class ENeuralNetworkPrecision : uint8
+{
+	Float32,
+	Float16,
+	Int8
+};
+
+/* Storage used by each of the threads that train the neural network with a mini-batch. */
+struct FNeuralNetworkTrainingWorker
+{
+	// The scratch buffers used to run the samples of this worker
+	FNeuralNetworkScratch scratch;
+
+	// The gradients accumulated for the samples of this worker, with the same layout as the weights
+	TArray<float, TAlignedHeapAllocator<16>> gradients;
+
+	// The error accumulated for the samples of this worker
+	float error = 0.0f;
+};
+
 /** This class implements a neural network used by the vehicles AI controller.
  *		The NN architecture is a Multi-Layer Perceptron (MLP).
  */
@@ -26,8 +72,34 @@ private:
 	// The dimension for the hidden layers in the neural network
 	TArray<int> nHiddenLayers;
 
-	// The weights for each layer of neural network, and for each neuron
-	TArray<TArray<TArray<float>>> weights;
+	// The dimensions of each layer of the neural network, including the input and output layers
+	TArray<int> dimensions;
+
+	/* The weights for each layer of the neural network, stored in a single contiguous buffer.
+	 *	Each layer is a row-major matrix with one row per unit and one column per unit in the previous layer,
+	 *	plus a last column for the weight of the bias. */
+	TSharedPtr<FNeuralNetworkWeights, ESPMode::ThreadSafe> weights;
+
+	// The weights of the neural network after quantization. When they are set, the float weights are released.
+	TSharedPtr<FNeuralNetworkQuantizedWeights, ESPMode::ThreadSafe> quantizedWeights;
+
+	// The offset of the weight matrix of each layer in the weights buffer
+	TArray<int> weightOffsets;
+
+	// The offset of the units of each layer in the scratch buffers
+	TArray<int> unitOffsets;
+
+	// The scratch buffers used by Run and Train, allocated once on Init
+	FNeuralNetworkScratch scratch;
+
+	// The scratch buffers used by RunBatch, grown to the largest batch run so far
+	FNeuralNetworkScratch batchScratch;
+
+	// The storage for each thread used by TrainBatch, grown to the largest number of threads used so far
+	TArray<FNeuralNetworkTrainingWorker> trainingWorkers;
+
+	// The number of samples per second processed by the last call to TrainBatch
+	float trainingSamplesPerSecond;
 
 	// The learning rate used for training
 	float learningRate;
@@ -46,18 +118,82 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
 	static UNeuralNetwork* GetInstance();
 
-	// Initializes the neural network with the specified dimensions
+	/* Factory method that creates a NN with the same structure and state as the given one, sharing its weights.
+	 *	The weights are only copied when one of the NNs that share them is trained. */
+	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
+	static UNeuralNetwork* GetSharedInstance(UNeuralNetwork* source);
+
+	/* Makes this NN have the same structure and state as the given one, sharing its weights like GetSharedInstance.
+	 *	The scratch buffers are only reallocated if the structure changes. */
+	void ShareWeightsFrom(const UNeuralNetwork* source);
+
+	// Logs the memory used by all the neural networks, and how much of it is saved by sharing weights
+	static void LogMemoryReport();
+
+	/* Initializes the neural network with the specified dimensions.
+	 *	The weights are initialized randomly, from the given seed if it is not 0. */
 	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
-	void Init(int inputs, int outputs, TArray<int> hiddenLayers, float _initialLearningRate = 0.1f, float _learningRateDecay = 0.001f);
+	void Init(int inputs, int outputs, TArray<int> hiddenLayers, float _initialLearningRate = 0.1f, float _learningRateDecay = 0.001f, int _seed = 0);
 
 	// Runs the neural network for the given inputs and returns its ouput
 	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
-	TArray<float> Run(TArray<float> inputs);
+	TArray<float> Run(const TArray<float>& inputs);
+
+	/* Runs the neural network for the given inputs and writes its output into 'outputs'.
+	 *	This does not perform any heap allocation, as it uses the scratch buffers allocated on Init.
+	 *	Returns false if the dimensions of the inputs or outputs don't match the ones of the NN. */
+	bool Run(TArrayView<const float> inputs, TArrayView<float> outputs);
+
+	/* Runs the neural network for a batch of input vectors, stored row-major (batchSize x inputs).
+	 *	Returns the outputs for each input vector, also row-major (batchSize x outputs). */
+	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
+	TArray<float> RunBatch(const TArray<float>& inputs, int batchSize);
+
+	/* Runs the neural network for a batch of input vectors, writing the outputs into 'outputs'.
+	 *	The layers are computed as matrix-matrix products, so the weights are read once for the whole batch.
+	 *	Returns false if the dimensions of the inputs or outputs don't match the ones of the NN. */
+	bool RunBatch(TArrayView<const float> inputs, int batchSize, TArrayView<float> outputs);
 
 	/* Trains the neural network for the given inputs and expected output.
 	 *	Returns the error that was made in this iteration. */
 	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
-	float Train(TArray<float> inputs, TArray<float> expectedOutputs);
+	float Train(const TArray<float>& inputs, const TArray<float>& expectedOutputs);
+
+	/* Trains the neural network with a mini-batch of samples, with the inputs and expected outputs stored row-major.
+	 *	Returns the mean error that was made for the samples of the batch. */
+	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
+	float TrainBatch(const TArray<float>& inputs, const TArray<float>& expectedOutputs, int batchSize, int numThreads = 4);
+
+	/* Trains the neural network with a mini-batch of samples.
+	 *	The batch is split in 'numThreads' chunks, whose gradients are computed in parallel and then added up in order,
+	 *	so the result is the same for the same samples and number of threads. The weights are updated once per batch. */
+	float TrainBatch(TArrayView<const float> inputs, TArrayView<const float> expectedOutputs, int batchSize, int numThreads);
+
+	/* Quantizes the weights of the NN to the given precision, after which it can only be used for inference.
+	 *	The NN is run for the given recorded inputs (numInputs x inputs, row-major) before and after quantizing,
+	 *	and the maximum difference of the outputs is returned (0 if there are no recorded inputs, -1 on failure). */
+	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
+	float Quantize(ENeuralNetworkPrecision precision, const TArray<float>& recordedInputs);
+
+	// Returns the precision used to store the weights of the NN
+	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
+	ENeuralNetworkPrecision GetPrecision() const;
+
+	// Returns the number of samples per second processed by the last call to TrainBatch
+	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
+	FORCEINLINE float GetTrainingSamplesPerSecond() const { return trainingSamplesPerSecond; }
+
+	/* Saves the neural network to a binary file, with its structure, learning rate state and weights.
+	 *	Relative paths are relative to the project directory. Returns whether the file could be written. */
+	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
+	bool SaveToFile(const FString& fileName) const;
+
+	/* Loads the neural network from a binary file written by SaveToFile.
+	 *	The file is memory-mapped and its weights are used in place, until the NN is trained and they need to be copied.
+	 *	All NNs loaded from the same file share its weights.
+	 *	Relative paths are relative to the project directory. Returns whether the file could be loaded. */
+	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
+	bool LoadFromFile(const FString& fileName);
 
 	// Returns the structure of the NN as the dimensions of each layer
 	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
@@ -68,33 +204,50 @@ public:
     float GetWeight(int _layerId, int _fromInd, int _toInd);
 
 private:
-	// Runs the neural network for the given inputs and returns its ouput
-	//	Also returns the weighted sums and activations of each unit in each layer
-	TArray<float> Run(TArray<float> inputs, TArray<TArray<float>>* weightedSums, TArray<TArray<float>>* activations);
+	// Feeds forward the given inputs, storing the weighted sums and activations of each unit in the scratch buffers
+	// PRE: inputs has nInputs values and the scratch buffers have been allocated for this NN
+	void FeedForward(const float* inputs, FNeuralNetworkScratch& _scratch) const;
+
+	// Feeds forward a batch of inputs, storing the weighted sums and activations of each unit in the scratch buffers
+	// PRE: inputs has batchSize * nInputs values and the scratch buffers have been allocated for at least batchSize elements
+	void FeedForwardBatch(const float* inputs, int batchSize, FNeuralNetworkScratch& _scratch) const;
+
+	/* Sets the dimensions of each layer of the NN, and computes the layout of the weights and scratch buffers for them.
+	 *	Returns the number of weights needed. */
+	int SetDimensions(const TArray<int>& _dimensions);
+
+	// Feeds forward a layer with quantized weights, for a batch of activations of the previous layer
+	void FeedForwardQuantizedLayer(int layer, int batchSize, const float* prevActivations, float* weightedSums, float* activations, FNeuralNetworkScratch& _scratch) const;
+
+	// Logs a warning and returns false if the NN hasn't been initialized, so it has no layers to run or train
+	bool CheckInitialized(const TCHAR* operation) const;
+
+	// Logs a warning and returns true if the NN has been quantized, so it can't be trained or saved
+	bool CheckQuantized(const TCHAR* operation) const;
 
-	// Calculates the dot product of two vectors
-	// PRE: a.Num() == b.Num()
-	float Dot(const TArray<float>& a, const TArray<float>& b) const;
+	// Makes sure the weights are owned only by this NN, copying them if they are shared or used in place from a file
+	void MakeWeightsWritable();
 
-	// Computes the error between the two given errors
-	float ComputeError(const TArray<float>& a, const TArray<float>& b) const;
+	/* Computes the deltas of each unit for the given expected outputs, after the inputs have been fed forward.
+	 *	Returns the error that was made. */
+	float Backpropagate(const float* expectedOutputs, FNeuralNetworkScratch& _scratch) const;
 
-	// Computes the difference of the two vectors: a - b
-	TArray<float> Difference(const TArray<float>& a, const TArray<float>& b) const;
+	// Allocates the scratch buffers for the dimensions of this NN and the given batch size
+	void AllocateScratch(FNeuralNetworkScratch& _scratch, int batchSize = 1) const;
 
-	// Computes the element-wise multiplication of two vectors
-	TArray<float> Multiply(const TArray<float>& a, const TArray<float>& b) const;
+	// Returns the values of the given layer in a scratch buffer
+	FORCEINLINE const float* GetLayerValues(const TArray<float, TAlignedHeapAllocator<16>>& values, int layer) const { return values.GetData() + unitOffsets[layer]; }
 
-	// Transposes the matrix
-	// Pre: 'a' represents a proper 2-D matrix
-	TArray<TArray<float>> Transpose(const TArray<TArray<float>>& a) const;
+	// Returns the number of layers of weights in the NN (i.e. all layers but the input one)
+	FORCEINLINE int NumLayers() const { return weightOffsets.Num(); }
 
-	// Reverses the vector
-	template<typename T> TArray<T> Reverse(const TArray<T>& a) const;
+	// Returns the weight matrix of the given layer
+	FORCEINLINE const float* GetLayerWeights(int layer) const { return weights->GetData() + weightOffsets[layer]; }
 
-	// The sigmoid function used as activation function for the neural network
-	FORCEINLINE float Sigmoid(float value) const { return 1.0f / (1.0f + FMath::Exp(-value)); }
+	// Returns the weight matrix of the given layer for writing
+	// PRE: the weights are writable (see MakeWeightsWritable)
+	FORCEINLINE float* GetMutableLayerWeights(int layer) { return weights->GetMutableData() + weightOffsets[layer]; }
 
-	// The derivative of the sigmoid function
-	FORCEINLINE float SigmoidPrime(float value) const { float s = Sigmoid(value); return s * (1 - s); } 
+	// The derivative of the sigmoid function used as activation function for the neural network, given the activation of the unit
+	FORCEINLINE float SigmoidPrimeFromActivation(float activation) const { return activation * (1 - activation); }
 };
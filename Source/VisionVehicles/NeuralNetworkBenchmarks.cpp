@@ -0,0 +1,447 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "VisionVehicles.h"
+#include "NeuralNetworkKernels.h"
+#include "NeuralNetwork.h"
+
+// Console commands that benchmark and check the neural network code. Results are written to the log.
+
+// Fills the array with random values in [-1, 1]
+static void FillRandom(TArray<float>& values, int num, FRandomStream& random)
+{
+	values.SetNumUninitialized(num);
+	for (int i = 0; i < num; i++)
+	{
+		values[i] = random.FRandRange(-1.0f, 1.0f);
+	}
+}
+
+// Benchmarks the vectorized dense-layer kernels against their scalar reference, for square layers of several widths
+static void BenchmarkKernels()
+{
+	const int widths[] = { 8, 16, 32, 64, 128, 256, 512 };
+	const int workPerWidth = 1 << 24; // Number of multiply-adds run for each width
+
+	FRandomStream random(0);
+	for (int width : widths)
+	{
+		TArray<float> weights, inputs, weightedSums, activations, referenceWeightedSums, referenceActivations;
+		FillRandom(weights, width * (width + 1), random);
+		FillRandom(inputs, width, random);
+		weightedSums.SetNumZeroed(width);
+		activations.SetNumZeroed(width);
+		referenceWeightedSums.SetNumZeroed(width);
+		referenceActivations.SetNumZeroed(width);
+
+		int iterations = FMath::Max(1, workPerWidth / (width * width));
+
+		// Forward pass
+		double startTime = FPlatformTime::Seconds();
+		for (int k = 0; k < iterations; k++)
+		{
+			FNeuralNetworkKernels::ForwardLayerReference(weights.GetData(), width, width, inputs.GetData(), referenceWeightedSums.GetData(), referenceActivations.GetData());
+		}
+		double referenceForwardTime = FPlatformTime::Seconds() - startTime;
+
+		startTime = FPlatformTime::Seconds();
+		for (int k = 0; k < iterations; k++)
+		{
+			FNeuralNetworkKernels::ForwardLayer(weights.GetData(), width, width, inputs.GetData(), weightedSums.GetData(), activations.GetData());
+		}
+		double forwardTime = FPlatformTime::Seconds() - startTime;
+
+		float maxError = 0.0f;
+		for (int j = 0; j < width; j++)
+		{
+			maxError = FMath::Max(maxError, FMath::Abs(activations[j] - referenceActivations[j]));
+		}
+
+		// Weight update. The scale is zero so that the weights stay the same between iterations.
+		startTime = FPlatformTime::Seconds();
+		for (int k = 0; k < iterations; k++)
+		{
+			FNeuralNetworkKernels::AddOuterProductReference(weights.GetData(), width, width, activations.GetData(), inputs.GetData(), 0.0f);
+		}
+		double referenceUpdateTime = FPlatformTime::Seconds() - startTime;
+
+		startTime = FPlatformTime::Seconds();
+		for (int k = 0; k < iterations; k++)
+		{
+			FNeuralNetworkKernels::AddOuterProduct(weights.GetData(), width, width, activations.GetData(), inputs.GetData(), 0.0f);
+		}
+		double updateTime = FPlatformTime::Seconds() - startTime;
+
+		UE_LOG(LogTemp, Display, TEXT("Width %4d: forward %8.3f us (reference %8.3f us, speedup %.2fx, max error %g%s), update %8.3f us (reference %8.3f us, speedup %.2fx)"),
+			width,
+			forwardTime * 1e6 / iterations, referenceForwardTime * 1e6 / iterations, referenceForwardTime / forwardTime,
+			maxError, maxError <= FNeuralNetworkKernels::KernelTolerance ? TEXT("") : TEXT(" OVER TOLERANCE"),
+			updateTime * 1e6 / iterations, referenceUpdateTime * 1e6 / iterations, referenceUpdateTime / updateTime);
+	}
+}
+
+static FAutoConsoleCommand BenchmarkKernelsCommand(
+	TEXT("VV.NN.BenchmarkKernels"),
+	TEXT("Benchmarks the vectorized neural network kernels against the scalar reference for several layer widths."),
+	FConsoleCommandDelegate::CreateStatic(&BenchmarkKernels));
+
+// Computes the transposed product the way backpropagation used to: materializing the transpose and then doing a dot product per column
+static void MultiplyTransposedByCopy(const float* weights, int units, int inputs, const float* deltas, float* result)
+{
+	TArray<TArray<float>> transposed;
+	for (int i = 0; i < inputs + 1; i++)
+	{
+		TArray<float> column;
+		for (int j = 0; j < units; j++)
+		{
+			column.Add(weights[j * (inputs + 1) + i]);
+		}
+		transposed.Add(column);
+	}
+	for (int i = 0; i < inputs; i++)
+	{
+		result[i] = FNeuralNetworkKernels::Dot(transposed[i].GetData(), deltas, units);
+	}
+}
+
+// The state of a network trained by TrainByCopy: its weights in the layout of UNeuralNetwork, and the values of each layer
+struct FReferenceNetwork
+{
+	TArray<int> dimensions;
+	TArray<int> weightOffsets;
+	TArray<float> weights;
+	TArray<TArray<float>> weightedSums;
+	TArray<TArray<float>> activations;
+	TArray<TArray<float>> deltas;
+	float initialLearningRate;
+	float learningRateDecay;
+	int epoche;
+};
+
+// Copies the dimensions and weights of the given NN, which must have been initialized, and allocates the values of each layer
+static void InitReferenceNetwork(FReferenceNetwork& network, UNeuralNetwork* neuralNetwork, const TArray<int>& dimensions, float learningRate, float learningRateDecay)
+{
+	network.dimensions = dimensions;
+	network.weights.Reset();
+	network.weightOffsets.Reset();
+	for (int l = 0; l < dimensions.Num() - 1; l++)
+	{
+		network.weightOffsets.Add(network.weights.Num());
+		for (int j = 0; j < dimensions[l + 1]; j++)
+		{
+			for (int i = 0; i < dimensions[l] + 1; i++)
+			{
+				network.weights.Add(neuralNetwork->GetWeight(l, j, i));
+			}
+		}
+	}
+	network.weightedSums.SetNum(dimensions.Num());
+	network.activations.SetNum(dimensions.Num());
+	network.deltas.SetNum(dimensions.Num());
+	for (int l = 0; l < dimensions.Num(); l++)
+	{
+		network.weightedSums[l].SetNumZeroed(dimensions[l]);
+		network.activations[l].SetNumZeroed(dimensions[l]);
+		network.deltas[l].SetNumZeroed(dimensions[l]);
+	}
+	network.initialLearningRate = learningRate;
+	network.learningRateDecay = learningRateDecay;
+	network.epoche = 0;
+}
+
+// Trains the network with one sample the way Train used to: the sigmoid derivative is evaluated again from the weighted sums,
+//	and the weights of each layer are transposed into a copy to backpropagate the deltas. Returns the error before the update.
+static float TrainByCopy(FReferenceNetwork& network, const float* inputs, const float* expectedOutputs)
+{
+	const TArray<int>& dimensions = network.dimensions;
+	int numLayers = dimensions.Num() - 1;
+	float learningRate = network.initialLearningRate / (1.0f + network.learningRateDecay * network.epoche);
+
+	// Feed forward
+	FMemory::Memcpy(network.activations[0].GetData(), inputs, dimensions[0] * sizeof(float));
+	for (int l = 0; l < numLayers; l++)
+	{
+		FNeuralNetworkKernels::ForwardLayer(network.weights.GetData() + network.weightOffsets[l], dimensions[l + 1], dimensions[l],
+			network.activations[l].GetData(), network.weightedSums[l + 1].GetData(), network.activations[l + 1].GetData());
+	}
+
+	// Deltas of the output layer
+	float error = 0.0f;
+	for (int j = 0; j < dimensions[numLayers]; j++)
+	{
+		float difference = network.activations[numLayers][j] - expectedOutputs[j];
+		float s = FNeuralNetworkKernels::SigmoidApprox(network.weightedSums[numLayers][j]);
+		network.deltas[numLayers][j] = difference * s * (1 - s);
+		error += difference * difference;
+	}
+
+	// Backpropagation through a transposed copy of the weights of the next layer
+	for (int l = numLayers - 1; l > 0; l--)
+	{
+		float* d = network.deltas[l].GetData();
+		MultiplyTransposedByCopy(network.weights.GetData() + network.weightOffsets[l], dimensions[l + 1], dimensions[l], network.deltas[l + 1].GetData(), d);
+		for (int i = 0; i < dimensions[l]; i++)
+		{
+			float s = FNeuralNetworkKernels::SigmoidApprox(network.weightedSums[l][i]);
+			d[i] *= s * (1 - s);
+		}
+	}
+
+	// Alter the weights in each layer
+	for (int l = 0; l < numLayers; l++)
+	{
+		FNeuralNetworkKernels::AddOuterProduct(network.weights.GetData() + network.weightOffsets[l], dimensions[l + 1], dimensions[l],
+			network.deltas[l + 1].GetData(), network.activations[l].GetData(), -learningRate);
+	}
+	++network.epoche;
+
+	return error;
+}
+
+// Benchmarks Train against the old backpropagation for the default pawn topology and a wide one, and the backward step of each of their hidden layers
+static void BenchmarkTrain()
+{
+	struct FTopology { int inputs; TArray<int> hiddenLayers; int outputs; };
+	const FTopology topologies[] = { { 5, { 8 }, 2 }, { 64, { 128, 128 }, 2 } };
+	const int workPerTopology = 1 << 24; // Approximate number of multiply-adds run for each topology
+
+	FRandomStream random(0);
+	for (const FTopology& topology : topologies)
+	{
+		TArray<int> dimensions;
+		dimensions.Add(topology.inputs);
+		dimensions.Append(topology.hiddenLayers);
+		dimensions.Add(topology.outputs);
+
+		int numWeights = 0;
+		for (int l = 1; l < dimensions.Num(); l++)
+		{
+			numWeights += dimensions[l] * (dimensions[l - 1] + 1);
+		}
+		int iterations = FMath::Max(1, workPerTopology / (3 * numWeights));
+
+		UNeuralNetwork* neuralNetwork = UNeuralNetwork::GetInstance();
+		neuralNetwork->Init(topology.inputs, topology.outputs, topology.hiddenLayers, 0.1f, 0.001f, 1);
+
+		// The baseline starts from the same weights, so both should reach about the same error
+		FReferenceNetwork referenceNetwork;
+		InitReferenceNetwork(referenceNetwork, neuralNetwork, dimensions, 0.1f, 0.001f);
+
+		TArray<float> inputs, expectedOutputs;
+		FillRandom(inputs, topology.inputs, random);
+		FillRandom(expectedOutputs, topology.outputs, random);
+
+		float referenceError = 0.0f;
+		double startTime = FPlatformTime::Seconds();
+		for (int k = 0; k < iterations; k++)
+		{
+			referenceError = TrainByCopy(referenceNetwork, inputs.GetData(), expectedOutputs.GetData());
+		}
+		double referenceTrainTime = FPlatformTime::Seconds() - startTime;
+
+		float error = 0.0f;
+		startTime = FPlatformTime::Seconds();
+		for (int k = 0; k < iterations; k++)
+		{
+			error = neuralNetwork->Train(inputs, expectedOutputs);
+		}
+		double trainTime = FPlatformTime::Seconds() - startTime;
+
+		FString dimensionsString = FString::FromInt(dimensions[0]);
+		for (int l = 1; l < dimensions.Num(); l++)
+		{
+			dimensionsString += FString::Printf(TEXT("-%d"), dimensions[l]);
+		}
+		UE_LOG(LogTemp, Display, TEXT("Topology %s: Train %.3f us per sample (with transpose copy %.3f us, speedup %.2fx), last error %g (with transpose copy %g)"),
+			*dimensionsString, trainTime * 1e6 / iterations, referenceTrainTime * 1e6 / iterations, referenceTrainTime / trainTime, error, referenceError);
+
+		// The backward step of each hidden layer, before (transpose copy) and after (strided product)
+		for (int l = 1; l < dimensions.Num() - 1; l++)
+		{
+			int inputsOfNext = dimensions[l], units = dimensions[l + 1];
+			TArray<float> weights, deltas, result;
+			FillRandom(weights, units * (inputsOfNext + 1), random);
+			FillRandom(deltas, units, random);
+			result.SetNumZeroed(inputsOfNext);
+
+			startTime = FPlatformTime::Seconds();
+			for (int k = 0; k < iterations; k++)
+			{
+				MultiplyTransposedByCopy(weights.GetData(), units, inputsOfNext, deltas.GetData(), result.GetData());
+			}
+			double copyTime = FPlatformTime::Seconds() - startTime;
+
+			startTime = FPlatformTime::Seconds();
+			for (int k = 0; k < iterations; k++)
+			{
+				FNeuralNetworkKernels::MultiplyTransposed(weights.GetData(), units, inputsOfNext, deltas.GetData(), result.GetData());
+			}
+			double stridedTime = FPlatformTime::Seconds() - startTime;
+
+			UE_LOG(LogTemp, Display, TEXT("    Hidden layer %d (%d units): backward step %.3f us (with transpose copy %.3f us, speedup %.2fx)"),
+				l, inputsOfNext, stridedTime * 1e6 / iterations, copyTime * 1e6 / iterations, copyTime / stridedTime);
+		}
+	}
+}
+
+static FAutoConsoleCommand BenchmarkTrainCommand(
+	TEXT("VV.NN.BenchmarkTrain"),
+	TEXT("Benchmarks Train against the old transpose-copy backpropagation for the default pawn topology (5-8-2) and a wide one (64-128-128-2)."),
+	FConsoleCommandDelegate::CreateStatic(&BenchmarkTrain));
+
+// Benchmarks RunBatch for a wide topology with float weights and with each quantized precision
+static void BenchmarkQuantized()
+{
+	const int numInputs = 64, numOutputs = 2, batchSize = 256, iterations = 100;
+	const ENeuralNetworkPrecision precisions[] = { ENeuralNetworkPrecision::Float32, ENeuralNetworkPrecision::Float16, ENeuralNetworkPrecision::Int8 };
+	const TCHAR* precisionNames[] = { TEXT("float32"), TEXT("float16"), TEXT("int8") };
+
+	FRandomStream random(0);
+	TArray<float> inputs, outputs;
+	FillRandom(inputs, numInputs * batchSize, random);
+	outputs.SetNumZeroed(numOutputs * batchSize);
+
+	for (int p = 0; p < ARRAY_COUNT(precisions); p++)
+	{
+		UNeuralNetwork* neuralNetwork = UNeuralNetwork::GetInstance();
+		neuralNetwork->Init(numInputs, numOutputs, { 128, 128 }, 0.1f, 0.001f, 1);
+		float maxError = neuralNetwork->Quantize(precisions[p], inputs);
+
+		double startTime = FPlatformTime::Seconds();
+		for (int k = 0; k < iterations; k++)
+		{
+			neuralNetwork->RunBatch(inputs, batchSize, outputs);
+		}
+		double runTime = FPlatformTime::Seconds() - startTime;
+
+		UE_LOG(LogTemp, Display, TEXT("Topology 64-128-128-2, %s: RunBatch of %d inputs %.3f us, max error %g"),
+			precisionNames[p], batchSize, runTime * 1e6 / iterations, maxError);
+	}
+}
+
+static FAutoConsoleCommand BenchmarkQuantizedCommand(
+	TEXT("VV.NN.BenchmarkQuantized"),
+	TEXT("Benchmarks batched inference of a wide topology (64-128-128-2) with float, half-precision and 8-bit weights."),
+	FConsoleCommandDelegate::CreateStatic(&BenchmarkQuantized));
+
+// Forwards every call to the allocator it wraps, counting the allocations made by one thread
+class FCountingMalloc : public FMalloc
+{
+public:
+	FCountingMalloc(FMalloc* _inner) : inner(_inner), threadId(0) {}
+
+	// Starts counting the allocations of the calling thread from zero
+	void Reset()
+	{
+		threadId = FPlatformTLS::GetCurrentThreadId();
+		numAllocations.Reset();
+	}
+
+	FORCEINLINE int32 GetNumAllocations() const { return numAllocations.GetValue(); }
+
+	// Begin FMalloc interface
+	virtual void* Malloc(SIZE_T Count, uint32 Alignment) override
+	{
+		CountAllocation();
+		return inner->Malloc(Count, Alignment);
+	}
+	virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override
+	{
+		if (Count > 0)
+		{
+			CountAllocation();
+		}
+		return inner->Realloc(Original, Count, Alignment);
+	}
+	virtual void Free(void* Original) override { inner->Free(Original); }
+	virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return inner->QuantizeSize(Count, Alignment); }
+	virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return inner->GetAllocationSize(Original, SizeOut); }
+	virtual void Trim() override { inner->Trim(); }
+	virtual void SetupTLSCachesOnCurrentThread() override { inner->SetupTLSCachesOnCurrentThread(); }
+	virtual void ClearAndDisableTLSCachesOnCurrentThread() override { inner->ClearAndDisableTLSCachesOnCurrentThread(); }
+	virtual bool IsInternallyThreadSafe() const override { return inner->IsInternallyThreadSafe(); }
+	virtual const TCHAR* GetDescriptiveName() override { return inner->GetDescriptiveName(); }
+	// End FMalloc interface
+
+private:
+	void CountAllocation()
+	{
+		if (FPlatformTLS::GetCurrentThreadId() == threadId)
+		{
+			numAllocations.Increment();
+		}
+	}
+
+	FMalloc* inner;
+	uint32 threadId;
+	FThreadSafeCounter numAllocations;
+};
+
+// Checks that a steady-state Run performs no heap allocations, for the default pawn topology and a wide one with each precision
+static void CheckRunAllocations()
+{
+	struct FTopology { int inputs; TArray<int> hiddenLayers; int outputs; };
+	const FTopology topologies[] = { { 5, { 8 }, 2 }, { 64, { 128, 128 }, 2 } };
+	const ENeuralNetworkPrecision precisions[] = { ENeuralNetworkPrecision::Float32, ENeuralNetworkPrecision::Float16, ENeuralNetworkPrecision::Int8 };
+	const TCHAR* precisionNames[] = { TEXT("float32"), TEXT("float16"), TEXT("int8") };
+	const int iterations = 1000;
+
+	// Other threads keep allocating while the allocator is wrapped, and may still be calling it after it is restored, so it is never destroyed
+	static FCountingMalloc* countingMalloc = new FCountingMalloc(GMalloc);
+
+	FRandomStream random(0);
+	int numFailed = 0, numChecked = 0;
+	for (const FTopology& topology : topologies)
+	{
+		TArray<float> inputs, outputs;
+		FillRandom(inputs, topology.inputs, random);
+		outputs.SetNumZeroed(topology.outputs);
+
+		for (int p = 0; p < ARRAY_COUNT(precisions); p++)
+		{
+			UNeuralNetwork* neuralNetwork = UNeuralNetwork::GetInstance();
+			neuralNetwork->Init(topology.inputs, topology.outputs, topology.hiddenLayers, 0.1f, 0.001f, 1);
+			if (precisions[p] != ENeuralNetworkPrecision::Float32)
+			{
+				neuralNetwork->Quantize(precisions[p], inputs);
+			}
+
+			// Warm up, then count the allocations of the runs
+			neuralNetwork->Run(TArrayView<const float>(inputs), TArrayView<float>(outputs));
+
+			FMalloc* previousMalloc = GMalloc;
+			countingMalloc->Reset();
+			GMalloc = countingMalloc;
+			for (int k = 0; k < iterations; k++)
+			{
+				neuralNetwork->Run(TArrayView<const float>(inputs), TArrayView<float>(outputs));
+			}
+			GMalloc = previousMalloc;
+			int numAllocations = countingMalloc->GetNumAllocations();
+
+			FString dimensionsString = FString::FromInt(topology.inputs);
+			for (int units : topology.hiddenLayers)
+			{
+				dimensionsString += FString::Printf(TEXT("-%d"), units);
+			}
+			dimensionsString += FString::Printf(TEXT("-%d"), topology.outputs);
+
+			++numChecked;
+			if (numAllocations > 0)
+			{
+				++numFailed;
+				UE_LOG(LogTemp, Warning, TEXT("Topology %s, %s: %d allocations in %d runs."), *dimensionsString, precisionNames[p], numAllocations, iterations);
+			}
+			else
+			{
+				UE_LOG(LogTemp, Display, TEXT("Topology %s, %s: no allocations in %d runs."), *dimensionsString, precisionNames[p], iterations);
+			}
+		}
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("Run allocation check: %d of %d networks ran without allocating."), numChecked - numFailed, numChecked);
+}
+
+static FAutoConsoleCommand CheckRunAllocationsCommand(
+	TEXT("VV.NN.CheckRunAllocations"),
+	TEXT("Checks that running a neural network after the first call performs no heap allocations, with float, half-precision and 8-bit weights."),
+	FConsoleCommandDelegate::CreateStatic(&CheckRunAllocations));
@@ -0,0 +1,292 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "VisionVehicles.h"
+#include "NeuralNetworkKernels.h"
+
+// The sigmoid is approximated as 0.5 + 0.5 * tanh(x / 2), where tanh(t) is the [7/6] Pade approximant:
+//	t * (135135 + 17325 t^2 + 378 t^4 + t^6) / (135135 + 62370 t^2 + 3150 t^4 + 28 t^6)
+// with t clamped to [-4.97, 4.97], where the approximant reaches 1. This keeps the error below 5e-5.
+static const float TanhClamp = 4.97f;
+
+const float FNeuralNetworkKernels::SigmoidTolerance = 5e-5f;
+const float FNeuralNetworkKernels::KernelTolerance = 1e-4f;
+
+// Returns the sum of the 4 components of the vector
+static FORCEINLINE float HorizontalSum(const VectorRegister& v)
+{
+	float components[4];
+	VectorStore(v, components);
+	return (components[0] + components[1]) + (components[2] + components[3]);
+}
+
+float FNeuralNetworkKernels::Dot(const float* a, const float* b, int n)
+{
+	// Use two accumulators to hide the latency of the multiply-adds
+	VectorRegister sum0 = VectorZero();
+	VectorRegister sum1 = VectorZero();
+	int i = 0;
+	for (; i + 8 <= n; i += 8)
+	{
+		sum0 = VectorMultiplyAdd(VectorLoad(a + i), VectorLoad(b + i), sum0);
+		sum1 = VectorMultiplyAdd(VectorLoad(a + i + 4), VectorLoad(b + i + 4), sum1);
+	}
+	if (i + 4 <= n)
+	{
+		sum0 = VectorMultiplyAdd(VectorLoad(a + i), VectorLoad(b + i), sum0);
+		i += 4;
+	}
+
+	float value = HorizontalSum(VectorAdd(sum0, sum1));
+	for (; i < n; i++)
+	{
+		value += a[i] * b[i];
+	}
+	return value;
+}
+
+void FNeuralNetworkKernels::ForwardLayer(const float* weights, int units, int inputs, const float* prevActivation, float* weightedSums, float* activations)
+{
+	for (int j = 0; j < units; j++)
+	{
+		const float* w = weights + j * (inputs + 1);
+		weightedSums[j] = Dot(w, prevActivation, inputs) + w[inputs]; // The last weight is the one for the bias
+	}
+	Sigmoid(weightedSums, activations, units);
+}
+
+void FNeuralNetworkKernels::ForwardLayerReference(const float* weights, int units, int inputs, const float* prevActivation, float* weightedSums, float* activations)
+{
+	for (int j = 0; j < units; j++)
+	{
+		const float* w = weights + j * (inputs + 1);
+		float z = w[inputs];
+		for (int i = 0; i < inputs; i++)
+		{
+			z += w[i] * prevActivation[i];
+		}
+		weightedSums[j] = z;
+		activations[j] = SigmoidReference(z);
+	}
+}
+
+void FNeuralNetworkKernels::ForwardLayerBatch(const float* weights, int units, int inputs, int batchSize, const float* prevActivations, float* weightedSums, float* activations)
+{
+	for (int j = 0; j < units; j++)
+	{
+		ForwardUnitBatch(weights + j * (inputs + 1), j, units, inputs, batchSize, prevActivations, weightedSums);
+	}
+	Sigmoid(weightedSums, activations, units * batchSize);
+}
+
+void FNeuralNetworkKernels::ForwardUnitBatch(const float* unitWeights, int unit, int units, int inputs, int batchSize, const float* prevActivations, float* weightedSums)
+{
+	const float* w = unitWeights;
+
+	// Compute 4 batch elements at a time, so each load of the weights is used 4 times
+	int b = 0;
+	for (; b + 4 <= batchSize; b += 4)
+	{
+		const float* x0 = prevActivations + b * inputs;
+		const float* x1 = x0 + inputs;
+		const float* x2 = x1 + inputs;
+		const float* x3 = x2 + inputs;
+
+		VectorRegister sum0 = VectorZero();
+		VectorRegister sum1 = VectorZero();
+		VectorRegister sum2 = VectorZero();
+		VectorRegister sum3 = VectorZero();
+		int i = 0;
+		for (; i + 4 <= inputs; i += 4)
+		{
+			VectorRegister wv = VectorLoad(w + i);
+			sum0 = VectorMultiplyAdd(wv, VectorLoad(x0 + i), sum0);
+			sum1 = VectorMultiplyAdd(wv, VectorLoad(x1 + i), sum1);
+			sum2 = VectorMultiplyAdd(wv, VectorLoad(x2 + i), sum2);
+			sum3 = VectorMultiplyAdd(wv, VectorLoad(x3 + i), sum3);
+		}
+
+		float z0 = HorizontalSum(sum0) + w[inputs];
+		float z1 = HorizontalSum(sum1) + w[inputs];
+		float z2 = HorizontalSum(sum2) + w[inputs];
+		float z3 = HorizontalSum(sum3) + w[inputs];
+		for (; i < inputs; i++)
+		{
+			z0 += w[i] * x0[i];
+			z1 += w[i] * x1[i];
+			z2 += w[i] * x2[i];
+			z3 += w[i] * x3[i];
+		}
+
+		weightedSums[b * units + unit] = z0;
+		weightedSums[(b + 1) * units + unit] = z1;
+		weightedSums[(b + 2) * units + unit] = z2;
+		weightedSums[(b + 3) * units + unit] = z3;
+	}
+	for (; b < batchSize; b++)
+	{
+		weightedSums[b * units + unit] = Dot(w, prevActivations + b * inputs, inputs) + w[inputs];
+	}
+}
+
+void FNeuralNetworkKernels::ForwardLayerInt8(const uint8* weights, int units, int inputs, float scale, float zeroPoint, const float* prevActivation, float* weightedSums, float* activations)
+{
+	// Sum((q - zeroPoint) * scale * x) = scale * (Sum(q * x) - zeroPoint * Sum(x))
+	float inputSum = 0.0f;
+	for (int i = 0; i < inputs; i++)
+	{
+		inputSum += prevActivation[i];
+	}
+
+	for (int j = 0; j < units; j++)
+	{
+		const uint8* w = weights + j * (inputs + 1);
+
+		VectorRegister sum = VectorZero();
+		int i = 0;
+		for (; i + 4 <= inputs; i += 4)
+		{
+			sum = VectorMultiplyAdd(VectorLoadByte4(w + i), VectorLoad(prevActivation + i), sum);
+		}
+		float value = HorizontalSum(sum);
+		for (; i < inputs; i++)
+		{
+			value += w[i] * prevActivation[i];
+		}
+
+		weightedSums[j] = scale * (value - zeroPoint * inputSum + (w[inputs] - zeroPoint)); // The last weight is the one for the bias
+	}
+	Sigmoid(weightedSums, activations, units);
+}
+
+void FNeuralNetworkKernels::DequantizeInt8(const uint8* weights, int n, float scale, float zeroPoint, float* result)
+{
+	const VectorRegister scaleVector = VectorSetFloat1(scale);
+	const VectorRegister offsetVector = VectorSetFloat1(-zeroPoint * scale);
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		VectorStore(VectorMultiplyAdd(VectorLoadByte4(weights + i), scaleVector, offsetVector), result + i);
+	}
+	for (; i < n; i++)
+	{
+		result[i] = (weights[i] - zeroPoint) * scale;
+	}
+}
+
+void FNeuralNetworkKernels::DequantizeFloat16(const FFloat16* weights, int n, float* result)
+{
+	for (int i = 0; i < n; i++)
+	{
+		result[i] = weights[i];
+	}
+}
+
+void FNeuralNetworkKernels::MultiplyTransposed(const float* weights, int units, int inputs, const float* deltas, float* result)
+{
+	// Accumulate each row of weights scaled by its delta, so the matrix is read in its row-major order
+	FMemory::Memzero(result, inputs * sizeof(float));
+	for (int j = 0; j < units; j++)
+	{
+		const float* w = weights + j * (inputs + 1);
+		VectorRegister dv = VectorSetFloat1(deltas[j]);
+
+		int i = 0;
+		for (; i + 4 <= inputs; i += 4)
+		{
+			VectorStore(VectorMultiplyAdd(dv, VectorLoad(w + i), VectorLoad(result + i)), result + i);
+		}
+		for (; i < inputs; i++)
+		{
+			result[i] += deltas[j] * w[i];
+		}
+	}
+}
+
+void FNeuralNetworkKernels::MultiplyTransposedReference(const float* weights, int units, int inputs, const float* deltas, float* result)
+{
+	for (int i = 0; i < inputs; i++)
+	{
+		float value = 0.0f;
+		for (int j = 0; j < units; j++)
+		{
+			value += weights[j * (inputs + 1) + i] * deltas[j];
+		}
+		result[i] = value;
+	}
+}
+
+void FNeuralNetworkKernels::AddOuterProduct(float* weights, int units, int inputs, const float* deltas, const float* prevActivation, float scale)
+{
+	for (int j = 0; j < units; j++)
+	{
+		float* w = weights + j * (inputs + 1);
+		float s = deltas[j] * scale;
+		VectorRegister sv = VectorSetFloat1(s);
+
+		int i = 0;
+		for (; i + 4 <= inputs; i += 4)
+		{
+			VectorStore(VectorMultiplyAdd(sv, VectorLoad(prevActivation + i), VectorLoad(w + i)), w + i);
+		}
+		for (; i < inputs; i++)
+		{
+			w[i] += s * prevActivation[i];
+		}
+
+		// Adjust the weight for the bias
+		w[inputs] += s;
+	}
+}
+
+void FNeuralNetworkKernels::AddOuterProductReference(float* weights, int units, int inputs, const float* deltas, const float* prevActivation, float scale)
+{
+	for (int j = 0; j < units; j++)
+	{
+		float* w = weights + j * (inputs + 1);
+		for (int i = 0; i < inputs; i++)
+		{
+			w[i] += deltas[j] * prevActivation[i] * scale;
+		}
+		w[inputs] += deltas[j] * scale;
+	}
+}
+
+void FNeuralNetworkKernels::Sigmoid(const float* values, float* result, int n)
+{
+	const VectorRegister half = VectorSetFloat1(0.5f);
+	const VectorRegister clampMin = VectorSetFloat1(-TanhClamp);
+	const VectorRegister clampMax = VectorSetFloat1(TanhClamp);
+	const VectorRegister p0 = VectorSetFloat1(135135.0f);
+	const VectorRegister p1 = VectorSetFloat1(17325.0f);
+	const VectorRegister p2 = VectorSetFloat1(378.0f);
+	const VectorRegister q1 = VectorSetFloat1(62370.0f);
+	const VectorRegister q2 = VectorSetFloat1(3150.0f);
+	const VectorRegister q3 = VectorSetFloat1(28.0f);
+
+	int i = 0;
+	for (; i + 4 <= n; i += 4)
+	{
+		VectorRegister t = VectorMultiply(VectorLoad(values + i), half);
+		t = VectorMin(VectorMax(t, clampMin), clampMax);
+		VectorRegister t2 = VectorMultiply(t, t);
+
+		VectorRegister p = VectorMultiply(t, VectorMultiplyAdd(t2, VectorMultiplyAdd(t2, VectorAdd(t2, p2), p1), p0));
+		VectorRegister q = VectorMultiplyAdd(t2, VectorMultiplyAdd(t2, VectorMultiplyAdd(t2, q3, q2), q1), p0);
+		VectorRegister tanh = VectorMultiply(p, VectorReciprocalAccurate(q));
+
+		VectorStore(VectorMultiplyAdd(half, tanh, half), result + i);
+	}
+	for (; i < n; i++)
+	{
+		result[i] = SigmoidApprox(values[i]);
+	}
+}
+
+float FNeuralNetworkKernels::SigmoidApprox(float value)
+{
+	float t = FMath::Clamp(value * 0.5f, -TanhClamp, TanhClamp);
+	float t2 = t * t;
+	float p = t * (135135.0f + t2 * (17325.0f + t2 * (378.0f + t2)));
+	float q = 135135.0f + t2 * (62370.0f + t2 * (3150.0f + t2 * 28.0f));
+	return 0.5f + 0.5f * p / q;
+}
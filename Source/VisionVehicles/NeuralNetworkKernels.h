@@ -0,0 +1,65 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+/** Dense-layer kernels used by the neural network.
+ *		Layer matrices are row-major, with one row per unit and 'inputs + 1' columns, the last one being the bias weight.
+ *		The kernels use the engine vector intrinsics, which map to SSE on x86, NEON on ARM, and a scalar FPU fallback elsewhere.
+ *		Each kernel has a scalar reference version, and the results of both match within KernelTolerance.
+ */
+struct VISIONVEHICLES_API FNeuralNetworkKernels
+{
+	/* Maximum absolute error of SigmoidApprox with respect to the exact sigmoid. */
+	static const float SigmoidTolerance;
+
+	/* Maximum absolute difference between the activations computed by ForwardLayer and ForwardLayerReference,
+	 *	for layers with weights and inputs in [-1, 1] and up to 512 inputs.
+	 *	It is dominated by SigmoidTolerance, the rest being due to the different order of the sums. */
+	static const float KernelTolerance;
+
+	// Calculates the dot product of two vectors of size n
+	static float Dot(const float* a, const float* b, int n);
+
+	/* Computes the weighted sums and activations of a layer with the given number of units,
+	 *	from the activations of the previous layer, which has 'inputs' units. */
+	static void ForwardLayer(const float* weights, int units, int inputs, const float* prevActivation, float* weightedSums, float* activations);
+	static void ForwardLayerReference(const float* weights, int units, int inputs, const float* prevActivation, float* weightedSums, float* activations);
+
+	/* Computes the weighted sums and activations of a layer for a batch of activations of the previous layer.
+	 *	The activations are stored row-major, one row per batch element, so this is a matrix-matrix product
+	 *	that reads each row of weights once for the whole batch. */
+	static void ForwardLayerBatch(const float* weights, int units, int inputs, int batchSize, const float* prevActivations, float* weightedSums, float* activations);
+
+	/* Computes the weighted sums of the unit 'unit' of a layer for a batch, given its row of weights.
+	 *	The weighted sums are stored row-major, one row of 'units' values per batch element. */
+	static void ForwardUnitBatch(const float* unitWeights, int unit, int units, int inputs, int batchSize, const float* prevActivations, float* weightedSums);
+
+	/* Computes the weighted sums and activations of a layer with 8-bit quantized weights, where weight = (value - zeroPoint) * scale.
+	 *	The quantized values are converted to float in registers, so the weights are never expanded in memory. */
+	static void ForwardLayerInt8(const uint8* weights, int units, int inputs, float scale, float zeroPoint, const float* prevActivation, float* weightedSums, float* activations);
+
+	// Converts n 8-bit quantized weights to floats
+	static void DequantizeInt8(const uint8* weights, int n, float scale, float zeroPoint, float* result);
+
+	// Converts n half-precision weights to floats
+	static void DequantizeFloat16(const FFloat16* weights, int n, float* result);
+
+	/* Multiplies the transposed weight matrix of a layer by the deltas of its units, without materializing the transpose.
+	 *	The result has one value per unit in the previous layer; the bias column is not included. */
+	static void MultiplyTransposed(const float* weights, int units, int inputs, const float* deltas, float* result);
+	static void MultiplyTransposedReference(const float* weights, int units, int inputs, const float* deltas, float* result);
+
+	/* Adds the outer product of the deltas of a layer and the activations of the previous one, multiplied by 'scale', to the weights.
+	 *	The bias weights are updated as if the previous layer had an extra activation of 1. */
+	static void AddOuterProduct(float* weights, int units, int inputs, const float* deltas, const float* prevActivation, float scale);
+	static void AddOuterProductReference(float* weights, int units, int inputs, const float* deltas, const float* prevActivation, float scale);
+
+	// Computes the approximated sigmoid of each of the n values
+	static void Sigmoid(const float* values, float* result, int n);
+
+	// Approximates the sigmoid function as 0.5 + 0.5 * tanh(x / 2), using a rational approximation of tanh
+	static float SigmoidApprox(float value);
+
+	// The exact sigmoid function
+	static FORCEINLINE float SigmoidReference(float value) { return 1.0f / (1.0f + FMath::Exp(-value)); }
+};
@@ -0,0 +1,82 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "VisionVehicles.h"
+#include "NeuralNetworkWeights.h"
+#include "MappedFile.h"
+
+FNeuralNetworkWeights::FNeuralNetworkWeights(int numWeights)
+{
+	ownedData.SetNumZeroed(numWeights);
+	data = ownedData.GetData();
+	num = numWeights;
+}
+
+FNeuralNetworkWeights::FNeuralNetworkWeights(const TSharedPtr<FMappedFile, ESPMode::ThreadSafe>& _mappedFile, const float* _data, int numWeights)
+{
+	mappedFile = _mappedFile;
+	data = _data;
+	num = numWeights;
+}
+
+TSharedPtr<FNeuralNetworkWeights, ESPMode::ThreadSafe> FNeuralNetworkWeights::Copy() const
+{
+	TSharedPtr<FNeuralNetworkWeights, ESPMode::ThreadSafe> copy = MakeShareable(new FNeuralNetworkWeights(num));
+	FMemory::Memcpy(copy->ownedData.GetData(), data, num * sizeof(float));
+	return copy;
+}
+
+TSharedPtr<FNeuralNetworkQuantizedWeights, ESPMode::ThreadSafe> FNeuralNetworkQuantizedWeights::QuantizeToInt8(const FNeuralNetworkWeights& weights, const TArray<int>& layerOffsets)
+{
+	TSharedPtr<FNeuralNetworkQuantizedWeights, ESPMode::ThreadSafe> quantized = MakeShareable(new FNeuralNetworkQuantizedWeights());
+	quantized->int8Data.SetNumUninitialized(weights.Num());
+
+	for (int l = 0; l < layerOffsets.Num(); l++)
+	{
+		int first = layerOffsets[l];
+		int last = l + 1 < layerOffsets.Num() ? layerOffsets[l + 1] : weights.Num();
+
+		// Map the range of the weights of the layer, which must include 0, to [0, 255]
+		float minWeight = 0.0f, maxWeight = 0.0f;
+		for (int i = first; i < last; i++)
+		{
+			minWeight = FMath::Min(minWeight, weights.GetData()[i]);
+			maxWeight = FMath::Max(maxWeight, weights.GetData()[i]);
+		}
+		float scale = maxWeight > minWeight ? (maxWeight - minWeight) / 255.0f : 1.0f;
+		float zeroPoint = FMath::RoundToFloat(-minWeight / scale);
+
+		for (int i = first; i < last; i++)
+		{
+			quantized->int8Data[i] = (uint8)FMath::Clamp(FMath::RoundToInt(weights.GetData()[i] / scale + zeroPoint), 0, 255);
+		}
+		quantized->scales.Add(scale);
+		quantized->zeroPoints.Add(zeroPoint);
+	}
+
+	return quantized;
+}
+
+TSharedPtr<FNeuralNetworkQuantizedWeights, ESPMode::ThreadSafe> FNeuralNetworkQuantizedWeights::ConvertToFloat16(const FNeuralNetworkWeights& weights)
+{
+	TSharedPtr<FNeuralNetworkQuantizedWeights, ESPMode::ThreadSafe> quantized = MakeShareable(new FNeuralNetworkQuantizedWeights());
+	quantized->halfData.SetNumUninitialized(weights.Num());
+	for (int i = 0; i < weights.Num(); i++)
+	{
+		quantized->halfData[i] = FFloat16(weights.GetData()[i]);
+	}
+	return quantized;
+}
+
+float FNeuralNetworkQuantizedWeights::GetWeight(int layer, int index) const
+{
+	if (IsFloat16())
+	{
+		return halfData[index];
+	}
+	return (int8Data[index] - zeroPoints[layer]) * scales[layer];
+}
+
+int64 FNeuralNetworkQuantizedWeights::GetAllocatedSize() const
+{
+	return int8Data.GetAllocatedSize() + halfData.GetAllocatedSize() + scales.GetAllocatedSize() + zeroPoints.GetAllocatedSize();
+}
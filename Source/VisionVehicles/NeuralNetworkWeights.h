@@ -0,0 +1,94 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+class FMappedFile;
+
+/** The storage for the weights of a neural network.
+ *		The weights are either owned in an aligned heap buffer, or used in place from a memory-mapped network file,
+ *		in which case they are read-only.
+ */
+class VISIONVEHICLES_API FNeuralNetworkWeights
+{
+public:
+	// Creates heap storage for the given number of weights, initialized to zero
+	explicit FNeuralNetworkWeights(int numWeights);
+
+	// Creates storage that uses the weights in place from a mapped file, keeping the file mapped while it is alive
+	FNeuralNetworkWeights(const TSharedPtr<FMappedFile, ESPMode::ThreadSafe>& _mappedFile, const float* _data, int numWeights);
+
+	// Returns a copy of these weights, owned in heap storage
+	TSharedPtr<FNeuralNetworkWeights, ESPMode::ThreadSafe> Copy() const;
+
+	// Returns the weights
+	FORCEINLINE const float* GetData() const { return data; }
+
+	// Returns the weights for writing
+	// PRE: !IsReadOnly()
+	FORCEINLINE float* GetMutableData() { check(!IsReadOnly()); return ownedData.GetData(); }
+
+	// Returns the number of weights
+	FORCEINLINE int Num() const { return num; }
+
+	// Returns whether the weights can't be modified, because they are used in place from a file
+	FORCEINLINE bool IsReadOnly() const { return mappedFile.IsValid(); }
+
+private:
+	// The weights, when they are owned by this storage
+	TArray<float, TAlignedHeapAllocator<16>> ownedData;
+
+	// The file the weights are used from, if they are not owned
+	TSharedPtr<FMappedFile, ESPMode::ThreadSafe> mappedFile;
+
+	// The weights
+	const float* data;
+
+	// The number of weights
+	int num;
+};
+
+/** The weights of a neural network after post-training quantization, which can only be used for inference.
+ *		They are stored either as half-precision floats, or as 8 bits per weight with a scale and zero point per layer,
+ *		so that weight = (value - zeroPoint) * scale.
+ */
+class VISIONVEHICLES_API FNeuralNetworkQuantizedWeights
+{
+public:
+	// Quantizes the weights to 8 bits, with a scale and zero point for each layer, given the offset of each layer in the weights
+	static TSharedPtr<FNeuralNetworkQuantizedWeights, ESPMode::ThreadSafe> QuantizeToInt8(const FNeuralNetworkWeights& weights, const TArray<int>& layerOffsets);
+
+	// Converts the weights to half-precision floats
+	static TSharedPtr<FNeuralNetworkQuantizedWeights, ESPMode::ThreadSafe> ConvertToFloat16(const FNeuralNetworkWeights& weights);
+
+	// Returns whether the weights are stored as half-precision floats, or as 8 bits
+	FORCEINLINE bool IsFloat16() const { return halfData.Num() > 0; }
+
+	// Returns the 8-bit weights
+	FORCEINLINE const uint8* GetInt8Data() const { return int8Data.GetData(); }
+
+	// Returns the half-precision weights
+	FORCEINLINE const FFloat16* GetFloat16Data() const { return halfData.GetData(); }
+
+	// Returns the scale of the 8-bit weights of the given layer
+	FORCEINLINE float GetScale(int layer) const { return scales[layer]; }
+
+	// Returns the zero point of the 8-bit weights of the given layer
+	FORCEINLINE float GetZeroPoint(int layer) const { return zeroPoints[layer]; }
+
+	// Returns the value of a weight of the given layer
+	float GetWeight(int layer, int index) const;
+
+	// Returns the number of bytes used to store the weights
+	int64 GetAllocatedSize() const;
+
+private:
+	// The 8-bit weights
+	TArray<uint8, TAlignedHeapAllocator<16>> int8Data;
+
+	// The half-precision weights
+	TArray<FFloat16, TAlignedHeapAllocator<16>> halfData;
+
+	// The scale and zero point of each layer of 8-bit weights
+	TArray<float> scales;
+	TArray<float> zeroPoints;
+};
@@ -2,12 +2,48 @@
 
 #include "VisionVehicles.h"
 #include "VehicleVisionComponent.h"
+#include "VisionFeedSource.h"
 
 UVehicleVisionComponent::UVehicleVisionComponent()
 {
 	// Set defaults
 	ClassColor = FLinearColor::Red;
 	ClassColorDistanceThreshold = 0.5f;
+	ClassLabel = TEXT("Track");
+	bComputeLabels = false;
+	RegionOfInterestMin = FVector2D(0.0f, 0.0f);
+	RegionOfInterestMax = FVector2D(1.0f, 1.0f);
+	DownsampleFactor = 1;
+	DownsampleMode = EVisionDownsampleMode::Render;
+	bAsyncReadback = true;
+	ReadbackLatency = 1;
+	bUseColorTable = false;
+	ColorTableBitsPerChannel = 6;
+	CaptureRate = 0.0f;
+	FeedSource = nullptr;
+	bSyntheticFeedWithoutRenderer = true;
+
+	latestWidth = latestHeight = 0;
+	latestFrame = 0;
+	bHasLatestPixels = false;
+	lastCaptureFrame = 0;
+	bDefaultCaptureEveryFrame = bCaptureEveryFrame;
+	fullResolutionTarget = nullptr;
+	downsampledTarget = nullptr;
+	lastSourceTime = 0.0f;
+	captureSlot = INDEX_NONE;
+	scheduleFrame = 0;
+	bCapturedThisFrame = false;
+	feedFrameAge = 0;
+	cachedFeedFrame = 0;
+	bCachedLabels = false;
+	bHasCachedFeed = false;
+	classifiedFrame = 0;
+	feedVersion = 0;
+	feedStatsFrame = 0;
+	frameCacheHits = frameReadbacks = 0;
+	lastFrameCacheHits = lastFrameReadbacks = 0;
+	frameBytesRead = lastFrameBytesRead = 0;
 
 	if (TextureTarget != nullptr)
 	{
@@ -15,42 +51,574 @@ UVehicleVisionComponent::UVehicleVisionComponent()
 	}
 }
 
-TBitArray<FDefaultBitArrayAllocator> UVehicleVisionComponent::GetFeed()
+void UVehicleVisionComponent::BeginDestroy()
+{
+	Super::BeginDestroy();
+
+	// Release the staging textures on the rendering thread, once it is done with any readback in flight
+	FVisionReadbackSlot* slots = readbackSlots;
+	ENQUEUE_UNIQUE_RENDER_COMMAND_ONEPARAMETER(
+		ReleaseVisionReadback,
+		FVisionReadbackSlot*, slots, slots,
+		{
+			for (int32 i = 0; i < UVehicleVisionComponent::MaxReadbackSlots; i++)
+			{
+				slots[i].stagingTexture.SafeRelease();
+			}
+		});
+	releaseFence.BeginFence();
+}
+
+bool UVehicleVisionComponent::IsReadyForFinishDestroy()
+{
+	return Super::IsReadyForFinishDestroy() && releaseFence.IsFenceComplete();
+}
+
+void UVehicleVisionComponent::BeginPlay()
+{
+	Super::BeginPlay();
+
+	captureSlot = FVisionCaptureScheduler::Get().Register();
+	bDefaultCaptureEveryFrame = bCaptureEveryFrame;
+
+	if (FeedSource == nullptr && GUsingNullRHI && bSyntheticFeedWithoutRenderer)
+	{
+		UE_LOG(LogTemp, Log, TEXT("There is no renderer, so %s sees a procedural road."), *GetOwner()->GetName());
+		FeedSource = NewObject<UProceduralRoadFeedSource>(this);
+	}
+	lastSourceTime = GetWorld()->GetTimeSeconds();
+}
+
+void UVehicleVisionComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	FVisionCaptureScheduler::Get().Unregister(captureSlot);
+	captureSlot = INDEX_NONE;
+
+	// Give back the render target the component was given
+	if (fullResolutionTarget != nullptr && TextureTarget == downsampledTarget)
+	{
+		TextureTarget = fullResolutionTarget;
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
+void UVehicleVisionComponent::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{
+	// Keep capturing on schedule even on frames where the feed isn't used. The component also ticks in the editor.
+	if (GetWorld() != nullptr && GetWorld()->IsGameWorld())
+	{
+		UpdateCapture();
+	}
+
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+}
+
+const FVisionMask& UVehicleVisionComponent::GetFeed()
+{
+	return GetClassFeed(0);
+}
+
+const FVisionMask& UVehicleVisionComponent::GetClassFeed(int32 classIndex)
+{
+	UpdateFeeds();
+	return cachedFeeds.IsValidIndex(classIndex) ? cachedFeeds[classIndex] : emptyFeed;
+}
+
+const TArray<uint8>& UVehicleVisionComponent::GetFeedLabels()
+{
+	UpdateFeeds();
+	return cachedLabels;
+}
+
+void UVehicleVisionComponent::UpdateFeeds()
+{
+	uint32 frame = GFrameNumber;
+	if (feedStatsFrame != frame)
+	{
+		lastFrameCacheHits = frameCacheHits;
+		lastFrameReadbacks = frameReadbacks;
+		lastFrameBytesRead = frameBytesRead;
+		frameCacheHits = frameReadbacks = 0;
+		frameBytesRead = 0;
+		feedStatsFrame = frame;
+	}
+
+	// Serve the feed from the cache if it has already been computed this frame with the same settings.
+	// The settings are compared in place, so a cache hit doesn't allocate.
+	bool bSameSettings = bHasCachedFeed && bCachedLabels == bComputeLabels && HasCachedClasses();
+	if (bSameSettings && cachedFeedFrame == frame)
+	{
+		++frameCacheHits;
+		return;
+	}
+	cachedFeedFrame = frame;
+	double startTime = FPlatformTime::Seconds();
+
+	// Get the raw feed from the camera, if it is captured this frame
+	bool bCaptured = UpdateCapture();
+	float sourceDeltaTime = 0.0f;
+	if (FeedSource != nullptr)
+	{
+		// The source generates a new feed instead of each capture
+		if (bCaptured)
+		{
+			latestFrame = frame;
+			float time = GetWorld() != nullptr ? GetWorld()->GetTimeSeconds() : 0.0f;
+			sourceDeltaTime = time - lastSourceTime;
+			lastSourceTime = time;
+		}
+	}
+	else if (GUsingNullRHI)
+	{
+		// There is no renderer to capture the feed with, for example in the headless training simulation
+		latestPixels.Reset();
+		latestWidth = latestHeight = 0;
+		latestFrame = frame;
+	}
+	else
+	{
+		if (bAsyncReadback)
+		{
+			UpdateAsyncReadback(bCaptured);
+		}
+		if (bAsyncReadback ? !bHasLatestPixels : bCaptured || latestPixels.Num() == 0)
+		{
+			// Read synchronously until the first asynchronous readback completes
+			ReadPixelsSynchronous();
+			latestFrame = GetReadableCaptureFrame();
+			frameBytesRead += latestPixels.Num() * sizeof(FColor);
+		}
+	}
+	feedFrameAge = frame - latestFrame;
+
+	// Between captures the feed classified from the latest pixels is still current
+	if (bSameSettings && classifiedFrame == latestFrame)
+	{
+		++frameCacheHits;
+	}
+	else
+	{
+		++frameReadbacks;
+		cachedFeedClasses.Reset();
+		GetClasses(cachedFeedClasses);
+		const TArray<FVisionClass>& classes = cachedFeedClasses;
+		bCachedLabels = bComputeLabels;
+		bHasCachedFeed = true;
+		classifiedFrame = latestFrame;
+		++feedVersion;
+		if (FeedSource != nullptr)
+		{
+			cachedFeeds.SetNum(classes.Num());
+			FeedSource->GenerateFeeds(classes, sourceDeltaTime, cachedFeeds);
+		}
+		else
+		{
+			ClassifyLatestPixels(classes);
+		}
+		for (FVisionMask& feed : cachedFeeds)
+		{
+			feed.FrameId = latestFrame;
+		}
+
+		if (bComputeLabels)
+		{
+			FVisionClassifier::BuildLabels(cachedFeeds.GetData(), cachedFeeds.Num(), cachedLabels);
+		}
+		else
+		{
+			cachedLabels.Reset();
+		}
+	}
+	FVisionCaptureScheduler::Get().RecordFeedTime(FPlatformTime::Seconds() - startTime);
+}
+
+void UVehicleVisionComponent::ClassifyLatestPixels(const TArray<FVisionClass>& classes)
+{
+	// Average blocks of pixels before classifying them, or classify every pixel and take a majority vote per block.
+	// When the feed is rendered downsampled, the pixels read back are already at the final resolution.
+	int32 downsampleFactor = DownsampleMode == EVisionDownsampleMode::Render ? 1 : FMath::Max(1, FMath::Min(DownsampleFactor, FMath::Min(latestWidth, latestHeight)));
+	const FColor* pixels = latestPixels.GetData();
+	int32 width = latestWidth, height = latestHeight;
+	bool bMajorityVote = downsampleFactor > 1 && DownsampleMode == EVisionDownsampleMode::Majority;
+	if (downsampleFactor > 1 && DownsampleMode == EVisionDownsampleMode::Box)
+	{
+		FVisionClassifier::DownsampleBox(latestPixels.GetData(), latestWidth, latestHeight, downsampleFactor, downsampledPixels);
+		pixels = downsampledPixels.GetData();
+		width = latestWidth / downsampleFactor;
+		height = latestHeight / downsampleFactor;
+	}
+	TArray<FVisionMask>& classifiedFeeds = bMajorityVote ? fullResolutionFeeds : cachedFeeds;
+
+	// Transform the raw feed into classified data, for all the classes at once.
+	// The colors and thresholds are refilled in place, so classifying doesn't allocate once the arrays have grown.
+	classColors.Reset();
+	distanceThresholds.Reset();
+	for (const FVisionClass& visionClass : classes)
+	{
+		classColors.Add(visionClass.Color);
+		distanceThresholds.Add(visionClass.DistanceThreshold);
+	}
+	classifiedFeeds.SetNum(classes.Num());
+	if (bUseColorTable)
+	{
+		if (!colorTable.IsBuiltFor(classColors, distanceThresholds, ColorTableBitsPerChannel))
+		{
+			double buildTime = colorTable.Build(classColors, distanceThresholds, ColorTableBitsPerChannel);
+			UE_LOG(LogTemp, Log, TEXT("Rebuilt the vision color table (%lld KB) for %d classes in %.3f ms."), colorTable.GetAllocatedSize() / 1024, classes.Num(), buildTime * 1000.0);
+		}
+		colorTable.Classify(pixels, width, height, classifiedFeeds.GetData());
+	}
+	else
+	{
+		FVisionClassifier::Classify(pixels, width, height, classColors.GetData(), distanceThresholds.GetData(), classes.Num(), classifiedFeeds.GetData());
+	}
+	if (bMajorityVote)
+	{
+		cachedFeeds.SetNum(classes.Num());
+		for (int32 c = 0; c < classes.Num(); c++)
+		{
+			FVisionClassifier::DownsampleMajority(fullResolutionFeeds[c], downsampleFactor, cachedFeeds[c]);
+		}
+	}
+}
+
+bool UVehicleVisionComponent::UpdateCapture()
+{
+	uint32 frame = GFrameNumber;
+	if (scheduleFrame == frame)
+	{
+		return bCapturedThisFrame;
+	}
+	scheduleFrame = frame;
+	UpdateCaptureTarget();
+
+	// The scene is captured here when the captures are scheduled or a source is used, and every frame by the renderer otherwise.
+	// Both can change at runtime, so the setting is restored when they don't apply anymore.
+	FVisionCaptureScheduler& scheduler = FVisionCaptureScheduler::Get();
+	bool bRendered = FeedSource == nullptr && !GUsingNullRHI;
+	bCaptureEveryFrame = CaptureRate > 0.0f || FeedSource != nullptr ? false : bDefaultCaptureEveryFrame;
+	if (CaptureRate > 0.0f)
+	{
+		bCapturedThisFrame = scheduler.ShouldCapture(captureSlot, CaptureRate);
+		if (bCapturedThisFrame && bRendered)
+		{
+			CaptureScene();
+		}
+	}
+	else
+	{
+		// A rate of 0 captures every frame, even if bCaptureEveryFrame was turned off
+		bCapturedThisFrame = true;
+		if (!bCaptureEveryFrame && bRendered)
+		{
+			CaptureScene();
+		}
+	}
+	if (bCapturedThisFrame)
+	{
+		scheduler.RecordCapture();
+	}
+	return bCapturedThisFrame;
+}
+
+void UVehicleVisionComponent::UpdateCaptureTarget()
+{
+	// The render target may be replaced at any time, except by the downsampled one
+	if (TextureTarget != nullptr && TextureTarget != downsampledTarget)
+	{
+		fullResolutionTarget = TextureTarget;
+	}
+	if (fullResolutionTarget == nullptr || FeedSource != nullptr || GUsingNullRHI)
+	{
+		return;
+	}
+	if (DownsampleMode != EVisionDownsampleMode::Render || DownsampleFactor <= 1)
+	{
+		TextureTarget = fullResolutionTarget;
+		return;
+	}
+
+	// Render into a target with the format of the given one and the downsampled size, so only the pixels kept are rendered and read back
+	int32 width = FMath::Max(1, fullResolutionTarget->SizeX / DownsampleFactor);
+	int32 height = FMath::Max(1, fullResolutionTarget->SizeY / DownsampleFactor);
+	if (downsampledTarget == nullptr)
+	{
+		downsampledTarget = NewObject<UTextureRenderTarget2D>(this, NAME_None, RF_Transient);
+	}
+	if (downsampledTarget->SizeX != width || downsampledTarget->SizeY != height || downsampledTarget->RenderTargetFormat != fullResolutionTarget->RenderTargetFormat)
+	{
+		downsampledTarget->RenderTargetFormat = fullResolutionTarget->RenderTargetFormat;
+		downsampledTarget->ClearColor = fullResolutionTarget->ClearColor;
+		downsampledTarget->bForceLinearGamma = fullResolutionTarget->bForceLinearGamma;
+		downsampledTarget->InitAutoFormat(width, height);
+	}
+	TextureTarget = downsampledTarget;
+}
+
+void UVehicleVisionComponent::GetClasses(TArray<FVisionClass>& classes) const
+{
+	classes.Add(FVisionClass(ClassLabel, ClassColor, ClassColorDistanceThreshold));
+	for (const FVisionClass& visionClass : AdditionalClasses)
+	{
+		// Classes past the maximum are ignored
+		if (classes.Num() == FVisionClassifier::MaxClasses)
+		{
+			break;
+		}
+		classes.Add(visionClass);
+	}
+}
+
+bool UVehicleVisionComponent::HasCachedClasses() const
+{
+	if (cachedFeedClasses.Num() != GetNumClasses() || !(cachedFeedClasses[0] == FVisionClass(ClassLabel, ClassColor, ClassColorDistanceThreshold)))
+	{
+		return false;
+	}
+	for (int32 c = 1; c < cachedFeedClasses.Num(); c++)
+	{
+		if (!(cachedFeedClasses[c] == AdditionalClasses[c - 1]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+int32 UVehicleVisionComponent::GetNumClasses() const
+{
+	return FMath::Min(1 + AdditionalClasses.Num(), FVisionClassifier::MaxClasses);
+}
+
+int32 UVehicleVisionComponent::FindClass(FName label) const
+{
+	if (label.IsNone())
+	{
+		return INDEX_NONE;
+	}
+	if (label == ClassLabel)
+	{
+		return 0;
+	}
+	int32 index = AdditionalClasses.IndexOfByPredicate([&](const FVisionClass& visionClass) { return visionClass.Label == label; });
+	return index != INDEX_NONE && index + 1 < FVisionClassifier::MaxClasses ? index + 1 : INDEX_NONE;
+}
+
+int32 UVehicleVisionComponent::GetFeedFrameAge() const
+{
+	return feedFrameAge;
+}
+
+void UVehicleVisionComponent::GetFeedCacheStats(int32& cacheHits, int32& readbacks) const
+{
+	// The stats of the current frame are not complete yet, unless GetFeed has not been called since the last frame
+	bool bStatsAreOld = feedStatsFrame != GFrameNumber;
+	cacheHits = bStatsAreOld ? frameCacheHits : lastFrameCacheHits;
+	readbacks = bStatsAreOld ? frameReadbacks : lastFrameReadbacks;
+}
+
+int32 UVehicleVisionComponent::GetFeedBytesRead() const
+{
+	return feedStatsFrame != GFrameNumber ? frameBytesRead : lastFrameBytesRead;
+}
+
+void UVehicleVisionComponent::GetCaptureStats(int32& lastFrameCaptures, float& averageCaptures, int32& maxCaptures, float& averageFeedTime, float& maxFeedTime)
+{
+	FVisionCaptureScheduler::FStats stats = FVisionCaptureScheduler::Get().GetStats();
+	lastFrameCaptures = stats.LastFrameCaptures;
+	averageCaptures = stats.AverageCaptures;
+	maxCaptures = stats.MaxCaptures;
+	averageFeedTime = stats.AverageFeedTime;
+	maxFeedTime = stats.MaxFeedTime;
+}
+
+void UVehicleVisionComponent::ReadPixelsSynchronous()
 {
-	// Get the raw feed from the camera
-	TArray<FColor> rawCameraFeed;
 	FTextureRenderTargetResource* renderTarget = TextureTarget->GameThread_GetRenderTargetResource();
-	renderTarget->ReadPixels(rawCameraFeed);
+	FIntRect region = GetRegionOfInterest(renderTarget->GetSizeXY());
+	if (region.Area() == 0)
+	{
+		latestPixels.Reset();
+		latestWidth = latestHeight = 0;
+		return;
+	}
+	renderTarget->ReadPixels(latestPixels, FReadSurfaceDataFlags(), region);
+	latestWidth = region.Width();
+	latestHeight = region.Height();
+}
+
+uint32 UVehicleVisionComponent::GetReadableCaptureFrame() const
+{
+	// UpdateCapture has run this frame, so the scene has already been captured here unless the renderer captures it
+	return bCaptureEveryFrame ? GFrameNumber - 1 : GFrameNumber;
+}
 
-	// Transform the raw feed into classified data
-	FLinearColor normalizedClassColor = ToNormalizedRGB(ClassColor);
-	int32 numPixels = rawCameraFeed.Num();
-	TBitArray<FDefaultBitArrayAllocator> feed;
-	feed.Init(false, numPixels);
-	for (int i = 0; i < numPixels; i++)
+FIntRect UVehicleVisionComponent::GetRegionOfInterest(FIntPoint size) const
+{
+	if (size.X <= 0 || size.Y <= 0)
 	{
-		// Use euclidean distance between normalized colors to determine if it belongs to the class
-		if (FLinearColor::Dist(ToNormalizedRGB(rawCameraFeed[i].ReinterpretAsLinear()), normalizedClassColor) < ClassColorDistanceThreshold)
+		return FIntRect();
+	}
+
+	FIntRect region(
+		FMath::FloorToInt(FMath::Clamp(RegionOfInterestMin.X, 0.0f, 1.0f) * size.X),
+		FMath::FloorToInt(FMath::Clamp(RegionOfInterestMin.Y, 0.0f, 1.0f) * size.Y),
+		FMath::CeilToInt(FMath::Clamp(RegionOfInterestMax.X, 0.0f, 1.0f) * size.X),
+		FMath::CeilToInt(FMath::Clamp(RegionOfInterestMax.Y, 0.0f, 1.0f) * size.Y));
+
+	// The region has at least one pixel, even when the corners are the same or swapped
+	region.Min.X = FMath::Min(region.Min.X, size.X - 1);
+	region.Min.Y = FMath::Min(region.Min.Y, size.Y - 1);
+	region.Max.X = FMath::Max(region.Max.X, region.Min.X + 1);
+	region.Max.Y = FMath::Max(region.Max.Y, region.Min.Y + 1);
+	return region;
+}
+
+void UVehicleVisionComponent::UpdateAsyncReadback(bool bCaptured)
+{
+	uint32 frame = GFrameNumber;
+	int32 latency = FMath::Clamp(ReadbackLatency, 1, MaxReadbackSlots - 2);
+
+	// Issue the readback of this frame's capture, unless all the slots are in flight
+	if (bCaptured && lastCaptureFrame != frame)
+	{
+		for (FVisionReadbackSlot& slot : readbackSlots)
 		{
-			feed[i] = true;
+			if (slot.state == FVisionReadbackSlot::Free)
+			{
+				slot.state = FVisionReadbackSlot::Copying;
+				slot.copyFrame = frame;
+				slot.captureFrame = GetReadableCaptureFrame();
+				lastCaptureFrame = frame;
+
+				// Only the region of interest is read back
+				FTextureRenderTargetResource* renderTarget = TextureTarget->GameThread_GetRenderTargetResource();
+				slot.region = GetRegionOfInterest(renderTarget->GetSizeXY());
+				if (slot.region.Area() == 0)
+				{
+					slot.state = FVisionReadbackSlot::Free;
+					break;
+				}
+				slot.width = slot.region.Width();
+				slot.height = slot.region.Height();
+				FVisionReadbackSlot* slotPtr = &slot;
+				ENQUEUE_UNIQUE_RENDER_COMMAND_TWOPARAMETER(
+					CopyVisionReadback,
+					FTextureRenderTargetResource*, renderTarget, renderTarget,
+					FVisionReadbackSlot*, slot, slotPtr,
+					{
+						FTexture2DRHIRef source = renderTarget->GetRenderTargetTexture();
+						slot->bStaged = source->GetFormat() == PF_B8G8R8A8;
+						if (slot->bStaged)
+						{
+							// (Re)create the staging texture if the render target changed size
+							if (!slot->stagingTexture.IsValid() || slot->stagingTexture->GetSizeX() != source->GetSizeX() || slot->stagingTexture->GetSizeY() != source->GetSizeY())
+							{
+								FRHIResourceCreateInfo createInfo;
+								slot->stagingTexture = RHICreateTexture2D(source->GetSizeX(), source->GetSizeY(), PF_B8G8R8A8, 1, 1, TexCreate_CPUReadback, createInfo);
+							}
+							RHICmdList.CopyToResolveTarget(source, slot->stagingTexture, true, FResolveParams());
+						}
+						else
+						{
+							// The format has to be converted, which can't be done with a copy
+							RHICmdList.ReadSurfaceData(source, slot->region, slot->pixels, FReadSurfaceDataFlags());
+						}
+					});
+				break;
+			}
 		}
 	}
 
-	return feed;
+	// Map the staging textures the GPU has had time to copy
+	for (FVisionReadbackSlot& slot : readbackSlots)
+	{
+		if (slot.state == FVisionReadbackSlot::Copying && frame - slot.copyFrame >= (uint32)latency)
+		{
+			slot.state = FVisionReadbackSlot::Mapping;
+			FVisionReadbackSlot* slotPtr = &slot;
+			ENQUEUE_UNIQUE_RENDER_COMMAND_ONEPARAMETER(
+				MapVisionReadback,
+				FVisionReadbackSlot*, slot, slotPtr,
+				{
+					if (slot->bStaged)
+					{
+						void* data = nullptr;
+						int32 rowPitch = 0, rows = 0;
+						RHICmdList.MapStagingSurface(slot->stagingTexture, data, rowPitch, rows);
+						slot->pixels.SetNumUninitialized(slot->width * slot->height);
+						const FColor* regionData = (const FColor*)data + slot->region.Min.Y * rowPitch + slot->region.Min.X;
+						for (int32 y = 0; y < slot->height; y++)
+						{
+							FMemory::Memcpy(&slot->pixels[y * slot->width], regionData + y * rowPitch, slot->width * sizeof(FColor));
+						}
+						RHICmdList.UnmapStagingSurface(slot->stagingTexture);
+					}
+				});
+			slot.fence.BeginFence();
+		}
+	}
+
+	// Take the most recent capture that has been read back
+	for (FVisionReadbackSlot& slot : readbackSlots)
+	{
+		if (slot.state == FVisionReadbackSlot::Mapping && slot.fence.IsFenceComplete())
+		{
+			if (!bHasLatestPixels || slot.captureFrame >= latestFrame)
+			{
+				Swap(latestPixels, slot.pixels);
+				frameBytesRead += latestPixels.Num() * sizeof(FColor);
+				latestWidth = slot.width;
+				latestHeight = slot.height;
+				latestFrame = slot.captureFrame;
+				bHasLatestPixels = true;
+			}
+			slot.state = FVisionReadbackSlot::Free;
+		}
+	}
 }
 
 TArray<bool> UVehicleVisionComponent::GetCameraFeed()
 {
-     TBitArray<FDefaultBitArrayAllocator> feed = GetFeed();
-     TArray<bool> result;
-     for (int i = 0; i < feed.Num(); i++)
-          result.Add(feed[i]);
-     return result;
+     return GetClassCameraFeed(0);
 }
 
-FLinearColor UVehicleVisionComponent::ToNormalizedRGB(const FLinearColor color) const
+TArray<bool> UVehicleVisionComponent::GetClassCameraFeed(int32 classIndex)
 {
-	FVector colorAsVector(color.R, color.G, color.B);
-	colorAsVector.Normalize();
-	return FLinearColor(colorAsVector.X, colorAsVector.Y, colorAsVector.Z, 1.0f);
-}
\ No newline at end of file
+	const FVisionMask& feed = GetClassFeed(classIndex);
+	TArray<bool> result;
+	result.SetNumUninitialized(feed.Num());
+	for (int32 i = 0; i < feed.Num(); i++)
+	{
+		result[i] = feed[i];
+	}
+	return result;
+}
+
+FIntPoint UVehicleVisionComponent::GetCameraFeedSize()
+{
+	const FVisionMask& feed = GetFeed();
+	return FIntPoint(feed.Width, feed.Height);
+}
+
+int32 UVehicleVisionComponent::GetFeedPositiveCount(int32 classIndex)
+{
+	return GetClassFeed(classIndex).CountPositive();
+}
+
+int32 UVehicleVisionComponent::GetFeedRegionPositiveCount(int32 classIndex, FIntPoint regionMin, FIntPoint regionMax)
+{
+	return GetClassFeed(classIndex).CountPositive(FIntRect(regionMin, regionMax));
+}
+
+bool UVehicleVisionComponent::GetFeedPixel(int32 classIndex, int32 x, int32 y)
+{
+	const FVisionMask& feed = GetClassFeed(classIndex);
+	return x >= 0 && x < feed.Width && y >= 0 && y < feed.Height && feed.Get(x, y);
+}
+
+TArray<uint8> UVehicleVisionComponent::GetCameraLabels()
+{
+	return GetFeedLabels();
+}
@@ -3,8 +3,96 @@
 #pragma once
 
 #include "Components/SceneCaptureComponent2D.h"
+#include "VisionClassifier.h"
+#include "VisionCaptureScheduler.h"
 #include "VehicleVisionComponent.generated.h"
 
+class UVisionFeedSource;
+
+/* A buffer the camera feed is read back into asynchronously.
+ *	The render target is copied into a CPU-readable staging texture when the capture is issued, and the staging
+ *	texture is mapped some frames later, when the GPU is done with the copy, so neither thread waits for the GPU. */
+struct FVisionReadbackSlot
+{
+	enum EState
+	{
+		Free,		// Not in use. Only accessed by the game thread.
+		Copying,	// The copy to the staging texture has been enqueued
+		Mapping		// The mapping of the staging texture has been enqueued, and the fence is pending
+	};
+
+	EState state = Free;
+
+	// The frame number the copy was enqueued in, and the frame number the copied capture was rendered in
+	uint32 copyFrame = 0;
+	uint32 captureFrame = 0;
+
+	// The region of the render target read back
+	FIntRect region;
+
+	// The CPU-readable texture the render target is copied into. Only accessed by the rendering thread.
+	FTexture2DRHIRef stagingTexture;
+
+	// Whether the render target was copied into the staging texture, or read directly because its format can't be copied
+	bool bStaged = false;
+
+	// The pixels read back, and the size of the region
+	TArray<FColor> pixels;
+	int32 width = 0;
+	int32 height = 0;
+
+	// The fence signaled when the pixels have been read back
+	FRenderCommandFence fence;
+};
+
+/* A class of elements in the camera feed, identified by their color. */
+USTRUCT(BlueprintType)
+struct FVisionClass
+{
+	GENERATED_USTRUCT_BODY()
+
+	/* The name used to find the class.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite)
+	FName Label;
+
+	/* The color to use as class tag. All elements in the camera feed that match this color will be positively classified.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite)
+	FLinearColor Color;
+
+	/* The margin of classification, as the euclidean distance between the pixel value and the Color.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite)
+	float DistanceThreshold;
+
+	FVisionClass()
+		: Color(FLinearColor::Red), DistanceThreshold(0.5f)
+	{
+	}
+
+	FVisionClass(FName label, const FLinearColor& color, float distanceThreshold)
+		: Label(label), Color(color), DistanceThreshold(distanceThreshold)
+	{
+	}
+
+	bool operator==(const FVisionClass& other) const
+	{
+		return Label == other.Label && Color == other.Color && DistanceThreshold == other.DistanceThreshold;
+	}
+};
+
+/* How the camera feed is downsampled before it is classified. */
+UENUM(BlueprintType)
+enum class EVisionDownsampleMode : uint8
+{
+	/* The scene is captured at the downsampled resolution, so fewer pixels are rendered, read back and classified. */
+	Render,
+	/* The region is read back at full resolution, each block of pixels is averaged, and the average is classified.
+	 * Only the classification cost drops with the factor. */
+	Box,
+	/* The region is read back at full resolution, each pixel is classified, and a block is positive if most of its pixels are.
+	 * Neither the readback nor the classification cost drop with the factor, only the size of the mask. */
+	Majority
+};
+
 /**
  * 
  */
@@ -21,18 +109,250 @@ class VISIONVEHICLES_API UVehicleVisionComponent : public USceneCaptureComponent
 	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
 	float ClassColorDistanceThreshold;
 
+	/* The label of the class of ClassColor, which is the first class.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
+	FName ClassLabel;
+
+	/* More classes to detect in the camera feed. All classes are classified in the same pass over the same capture.
+	 * There can be up to 7 additional classes.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
+	TArray<FVisionClass> AdditionalClasses;
+
+	/* Whether a label is computed for each pixel, with the first class it belongs to.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
+	bool bComputeLabels;
+
+	/* Whether the camera feed is read back from the GPU without blocking, returning the most recent frame that has completed.
+	 * Otherwise, every call to GetFeed waits for the GPU to finish rendering.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
+	bool bAsyncReadback;
+
+	/* The number of frames the GPU is given to copy a capture before it is read back, when the readback is asynchronous.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true", ClampMin = "1", ClampMax = "2", UIMin = "1", UIMax = "2"))
+	int32 ReadbackLatency;
+
+	/* Whether pixels are classified with a lookup table over quantized colors, rebuilt when the class color or threshold change.
+	 * It is faster than computing the distance of each pixel, but colors close to the threshold may be classified differently.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
+	bool bUseColorTable;
+
+	/* The number of bits per color channel of the lookup table. The table has 2^(3 * bits) entries.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true", ClampMin = "5", ClampMax = "7", UIMin = "5", UIMax = "7"))
+	int32 ColorTableBitsPerChannel;
+
+	/* The top left corner of the region of the camera feed that is read back and classified, in normalized coordinates.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
+	FVector2D RegionOfInterestMin;
+
+	/* The bottom right corner of the region of the camera feed that is read back and classified, in normalized coordinates.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
+	FVector2D RegionOfInterestMax;
+
+	/* The factor the region of interest is downsampled by before classification. 1 keeps every pixel.
+	 * The bytes read back only drop with it when DownsampleMode is Render.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true", ClampMin = "1", UIMin = "1", UIMax = "16"))
+	int32 DownsampleFactor;
+
+	/* How the feed is downsampled: by rendering it at a lower resolution, or by pooling blocks of pixels after the readback.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
+	EVisionDownsampleMode DownsampleMode;
+
+	/* The number of captures per second, or 0 to capture every frame. Between captures, GetFeed returns the feed of the last capture.
+	 * The captures of all the vision components with the same rate are staggered over the frames. bCaptureEveryFrame is off while it is set.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true", ClampMin = "0", UIMin = "0", UIMax = "60"))
+	float CaptureRate;
+
+	/* A source that generates the classified feed instead of the render target, for example a procedural road. The classes are
+	 * passed to the source, and the region of interest, downsampling and color table settings are not used. bCaptureEveryFrame is off while it is set.*/
+	UPROPERTY(Category = Vision, EditAnywhere, Instanced, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
+	UVisionFeedSource* FeedSource;
+
+	/* Whether a procedural road is used as the feed source when there is no renderer, as with -nullrhi, and no source is set.*/
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
+	bool bSyntheticFeedWithoutRenderer;
+
 public:
 	UVehicleVisionComponent();
 
-	/* Returns the camera feed as classified data.*/
+	// Begin UObject interface
+	virtual void BeginDestroy() override;
+	virtual bool IsReadyForFinishDestroy() override;
+	// End UObject interface
+
+	// Begin UActorComponent interface
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	virtual void TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction) override;
+	// End UActorComponent interface
+
+	/* Returns the camera feed as classified data, packed as one bit per pixel, with its size and the frame it was captured in.
+	 * The feed is read back and classified at most once per frame, and later calls in the same frame return the cached feed.*/
+	const FVisionMask& GetFeed();
+
+	/* Returns the camera feed classified for the class with the given index, where 0 is the class of ClassColor.
+	 * All the classes are classified from the same capture, so this doesn't read back the feed again.*/
+	const FVisionMask& GetClassFeed(int32 classIndex);
+
+	/* Returns the label of each pixel: 0 if it belongs to no class, or 1 + the index of the first class it belongs to.
+	 * It is empty unless bComputeLabels is set.*/
+	const TArray<uint8>& GetFeedLabels();
 
-	TBitArray<FDefaultBitArrayAllocator> GetFeed();
+	/* Returns a number that changes whenever the feeds are classified again, so results computed from them can be reused until then.*/
+	FORCEINLINE uint32 GetFeedVersion() const { return feedVersion; }
 
      UFUNCTION(BlueprintCallable)
           TArray<bool> GetCameraFeed();
 
+	/* Returns the camera feed classified for the class with the given index, where 0 is the class of ClassColor.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	TArray<bool> GetClassCameraFeed(int32 classIndex);
+
+	/* Returns the width and height of the camera feed, which is in row-major order. It doesn't have to be square.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	FIntPoint GetCameraFeedSize();
+
+	/* Returns the number of positive pixels of the feed of the given class.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	int32 GetFeedPositiveCount(int32 classIndex);
+
+	/* Returns the number of positive pixels of the feed of the given class in the region from regionMin (inclusive) to regionMax (exclusive), in pixels.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	int32 GetFeedRegionPositiveCount(int32 classIndex, FIntPoint regionMin, FIntPoint regionMax);
+
+	/* Returns whether the pixel at the given coordinates is positive in the feed of the given class. It is false outside of the feed.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	bool GetFeedPixel(int32 classIndex, int32 x, int32 y);
+
+	/* Returns the label of each pixel of the camera feed. See GetFeedLabels.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	TArray<uint8> GetCameraLabels();
+
+	/* Returns the number of classes, including the class of ClassColor.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	int32 GetNumClasses() const;
+
+	/* Returns the index of the class with the given label, or -1 if there is none or the label is None.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	int32 FindClass(FName label) const;
+
+	/* Returns how many frames old the last feed returned is. With a synchronous readback it is 0, or 1 if bCaptureEveryFrame is set,
+	 * because the renderer then captures the scene after the components tick.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	int32 GetFeedFrameAge() const;
+
+	/* Returns how many calls to GetFeed were served from the cache, and how many read back and classified the feed, in the last frame.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	void GetFeedCacheStats(int32& cacheHits, int32& readbacks) const;
+
+	/* Returns the number of bytes of the camera feed read back from the GPU in the last frame, after cropping to the region of interest.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	int32 GetFeedBytesRead() const;
+
+	/* Returns how many vision components captured in the last frame, the average and maximum per frame over the last frames,
+	 * and the average and maximum time per frame spent reading back and classifying their feeds, in milliseconds.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	static void GetCaptureStats(int32& lastFrameCaptures, float& averageCaptures, int32& maxCaptures, float& averageFeedTime, float& maxFeedTime);
+
 private:
-	/* Converts a color to normalized RGB format. 
-	 * This removes the luminosity of a color, making it the same regardless of shadows or bright spots. */
-	FLinearColor ToNormalizedRGB(const FLinearColor color) const;
+	/* The maximum number of captures in flight when the readback is asynchronous */
+	static const int32 MaxReadbackSlots = 4;
+
+	/* The buffers the camera feed is read back into asynchronously */
+	FVisionReadbackSlot readbackSlots[MaxReadbackSlots];
+
+	/* The most recent camera feed read back, its size, and the frame number it was captured in */
+	TArray<FColor> latestPixels;
+	int32 latestWidth, latestHeight;
+	uint32 latestFrame;
+	bool bHasLatestPixels;
+
+	/* The last frame number a capture was issued in */
+	uint32 lastCaptureFrame;
+
+	/* The world time the feed source last generated a feed at */
+	float lastSourceTime;
+
+	/* The value of bCaptureEveryFrame on BeginPlay, restored when the captures aren't scheduled */
+	bool bDefaultCaptureEveryFrame;
+
+	/* The render target the component was given, and the smaller one the scene is captured into when DownsampleMode is Render */
+	UPROPERTY(Transient)
+	UTextureRenderTarget2D* fullResolutionTarget;
+	UPROPERTY(Transient)
+	UTextureRenderTarget2D* downsampledTarget;
+
+	/* The stagger slot given by the capture scheduler, or -1 before BeginPlay */
+	int32 captureSlot;
+
+	/* The last frame number the capture was scheduled in, and whether the scene was captured in it */
+	uint32 scheduleFrame;
+	bool bCapturedThisFrame;
+
+	/* The frame age of the last feed returned */
+	int32 feedFrameAge;
+
+	/* The classified feed of each class in the current frame, and the frame number and classes it was computed with */
+	TArray<FVisionMask> cachedFeeds;
+	TArray<uint8> cachedLabels;
+	uint32 cachedFeedFrame;
+	TArray<FVisionClass> cachedFeedClasses;
+	bool bCachedLabels;
+	bool bHasCachedFeed;
+
+	/* The frame number of the pixels the cached feed was classified from, and the number of times the feeds have been classified */
+	uint32 classifiedFrame;
+	uint32 feedVersion;
+
+	/* The feed returned for classes that don't exist */
+	FVisionMask emptyFeed;
+
+	/* The pixels of the region of interest after box downsampling, and the masks before majority downsampling */
+	TArray<FColor> downsampledPixels;
+	TArray<FVisionMask> fullResolutionFeeds;
+
+	/* The number of cache hits, readbacks and bytes read back of GetFeed in the current frame and in the last frame */
+	uint32 feedStatsFrame;
+	int32 frameCacheHits, frameReadbacks, frameBytesRead;
+	int32 lastFrameCacheHits, lastFrameReadbacks, lastFrameBytesRead;
+
+	/* The color and distance threshold of each class, as the classifiers take them */
+	TArray<FLinearColor> classColors;
+	TArray<float> distanceThresholds;
+
+	/* The lookup table used to classify pixels when bUseColorTable is set */
+	FVisionColorTable colorTable;
+
+	/* The fence signaled when the staging textures have been released by the rendering thread */
+	FRenderCommandFence releaseFence;
+
+	/* Reads back and classifies the camera feed, unless it has already been done this frame or there is no new capture */
+	void UpdateFeeds();
+
+	/* Classifies the latest pixels into the cached feed of each class */
+	void ClassifyLatestPixels(const TArray<FVisionClass>& classes);
+
+	/* Captures the scene if it is this component's turn in the current frame. Returns whether the scene is captured in the current frame. */
+	bool UpdateCapture();
+
+	/* Makes the scene be captured into the downsampled render target when DownsampleMode is Render, or into the given one otherwise */
+	void UpdateCaptureTarget();
+
+	/* Returns the classes to classify, starting with the class of ClassColor */
+	void GetClasses(TArray<FVisionClass>& classes) const;
+
+	/* Returns whether the cached feed was computed for the classes GetClasses returns now, without building them */
+	bool HasCachedClasses() const;
+
+	/* Reads the camera feed into the latest pixels, waiting for the GPU to finish rendering */
+	void ReadPixelsSynchronous();
+
+	/* Returns the frame number of the capture a read of the render target issued now sees. When the renderer captures every frame,
+	 * it does so after the components tick, so it is the previous frame's capture. */
+	uint32 GetReadableCaptureFrame() const;
+
+	/* Returns the region of interest in pixels, for a render target of the given size. It is empty only if the render target is. */
+	FIntRect GetRegionOfInterest(FIntPoint size) const;
+
+	/* Issues the readback of this frame's capture if there is one, and advances the captures in flight. Updates the latest pixels if a capture has completed. */
+	void UpdateAsyncReadback(bool bCaptured);
 };
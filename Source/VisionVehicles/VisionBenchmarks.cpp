@@ -0,0 +1,310 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "VisionVehicles.h"
+#include "VisionClassifier.h"
+#include "VisionFeatures.h"
+#include "VisionFeedSource.h"
+
+// Console commands that benchmark the vision code. Results are written to the log.
+
+// The kinds of reference images the classifier is checked on
+enum class EReferenceImage
+{
+	Noise,	// Uniformly random colors
+	Track,	// A shaded grey road with a red band along it, with noise
+	Sweep	// All hues, with saturation and brightness changing along each axis
+};
+
+// Fills the pixels of a reference image of the given size
+static void MakeReferenceImage(EReferenceImage image, int32 size, TArray<FColor>& pixels, FRandomStream& random)
+{
+	pixels.SetNumUninitialized(size * size);
+	for (int32 y = 0; y < size; y++)
+	{
+		for (int32 x = 0; x < size; x++)
+		{
+			FColor& pixel = pixels[y * size + x];
+			switch (image)
+			{
+			case EReferenceImage::Noise:
+				pixel = FColor(random.RandRange(0, 255), random.RandRange(0, 255), random.RandRange(0, 255), 255);
+				break;
+			case EReferenceImage::Track:
+			{
+				float shade = 0.3f + 0.7f * x / size;
+				float bandCenter = size * (0.5f + 0.3f * FMath::Sin(6.0f * y / size));
+				bool bInBand = FMath::Abs(x - bandCenter) < size * 0.08f;
+				FLinearColor color = bInBand ? FLinearColor(0.8f, 0.15f, 0.1f) : FLinearColor(0.4f, 0.4f, 0.42f);
+				color = color * shade + FLinearColor(random.FRandRange(-0.05f, 0.05f), random.FRandRange(-0.05f, 0.05f), random.FRandRange(-0.05f, 0.05f));
+				pixel = color.ToFColor(false);
+				pixel.A = 255;
+				break;
+			}
+			case EReferenceImage::Sweep:
+				pixel = FLinearColor::FGetHSV((uint8)(x * 256 / size), (uint8)(y * 256 / size), (uint8)(255 - (x + y) * 128 / size)).ToFColor(false);
+				break;
+			}
+		}
+	}
+}
+
+// Benchmarks the vectorized classifier against the reference, on reference images of several sizes
+static void BenchmarkClassifier()
+{
+	const int32 sizes[] = { 64, 256, 1024 };
+	const EReferenceImage images[] = { EReferenceImage::Noise, EReferenceImage::Track, EReferenceImage::Sweep };
+	const TCHAR* imageNames[] = { TEXT("noise"), TEXT("track"), TEXT("sweep") };
+	const int32 workPerSize = 1 << 24; // Number of pixels classified for each size
+
+	const FLinearColor classColor = FLinearColor::Red;
+	const float distanceThreshold = 0.5f;
+
+	FRandomStream random(0);
+	for (int32 size : sizes)
+	{
+		int32 iterations = FMath::Max(1, workPerSize / (size * size));
+		for (int32 m = 0; m < ARRAY_COUNT(images); m++)
+		{
+			TArray<FColor> pixels;
+			MakeReferenceImage(images[m], size, pixels, random);
+			FVisionMask referenceMask, mask;
+
+			double startTime = FPlatformTime::Seconds();
+			for (int32 k = 0; k < iterations; k++)
+			{
+				FVisionClassifier::ClassifyReference(pixels.GetData(), size, size, classColor, distanceThreshold, referenceMask);
+			}
+			double referenceTime = FPlatformTime::Seconds() - startTime;
+
+			startTime = FPlatformTime::Seconds();
+			for (int32 k = 0; k < iterations; k++)
+			{
+				FVisionClassifier::Classify(pixels.GetData(), size, size, classColor, distanceThreshold, mask);
+			}
+			double classifyTime = FPlatformTime::Seconds() - startTime;
+
+			int32 mismatches = 0, positives = 0;
+			for (int32 i = 0; i < size * size; i++)
+			{
+				mismatches += mask[i] != referenceMask[i];
+				positives += referenceMask[i];
+			}
+
+			UE_LOG(LogTemp, Display, TEXT("%4dx%-4d %s: classify %9.3f us (reference %9.3f us, speedup %.2fx), %d positive pixels, %d mismatches%s"),
+				size, size, imageNames[m], classifyTime * 1e6 / iterations, referenceTime * 1e6 / iterations, referenceTime / classifyTime,
+				positives, mismatches, mismatches == 0 ? TEXT("") : TEXT(" MISMATCH"));
+		}
+	}
+}
+
+static FAutoConsoleCommand BenchmarkClassifierCommand(
+	TEXT("VV.Vision.BenchmarkClassifier"),
+	TEXT("Benchmarks the vectorized pixel classifier against the reference on 64x64, 256x256 and 1024x1024 reference images, and checks that the masks match."),
+	FConsoleCommandDelegate::CreateStatic(&BenchmarkClassifier));
+
+// Benchmarks the color lookup table for each quantization, with one class and with several classes at once
+static void BenchmarkColorTable()
+{
+	const int32 size = 1024;
+	const int32 iterations = 16;
+
+	TArray<FLinearColor> classColors;
+	TArray<float> distanceThresholds;
+	classColors.Add(FLinearColor::Red);
+	classColors.Add(FLinearColor::Green);
+	classColors.Add(FLinearColor::Blue);
+	classColors.Add(FLinearColor(0.4f, 0.4f, 0.42f));
+	distanceThresholds.Init(0.5f, classColors.Num());
+	TArray<FLinearColor> singleClassColor = { classColors[0] };
+	TArray<float> singleDistanceThreshold = { distanceThresholds[0] };
+
+	FRandomStream random(0);
+	TArray<FColor> pixels;
+	MakeReferenceImage(EReferenceImage::Track, size, pixels, random);
+
+	// The per-pixel classifier, once per class
+	FVisionMask referenceMask, masks[FVisionColorTable::MaxClasses];
+	FVisionClassifier::ClassifyReference(pixels.GetData(), size, size, classColors[0], distanceThresholds[0], referenceMask);
+	double startTime = FPlatformTime::Seconds();
+	for (int32 k = 0; k < iterations; k++)
+	{
+		for (int32 c = 0; c < classColors.Num(); c++)
+		{
+			FVisionClassifier::Classify(pixels.GetData(), size, size, classColors[c], distanceThresholds[c], masks[c]);
+		}
+	}
+	double classifyTime = (FPlatformTime::Seconds() - startTime) / iterations;
+	UE_LOG(LogTemp, Display, TEXT("%dx%d track: classify %.3f us for 1 class, %.3f us for %d classes"),
+		size, size, classifyTime * 1e6 / classColors.Num(), classifyTime * 1e6, classColors.Num());
+
+	for (int32 bits = FVisionColorTable::MinBitsPerChannel; bits <= FVisionColorTable::MaxBitsPerChannel; bits++)
+	{
+		FVisionColorTable singleClassTable, table;
+		double singleBuildTime = singleClassTable.Build(singleClassColor, singleDistanceThreshold, bits);
+		double buildTime = table.Build(classColors, distanceThresholds, bits);
+
+		startTime = FPlatformTime::Seconds();
+		for (int32 k = 0; k < iterations; k++)
+		{
+			singleClassTable.Classify(pixels.GetData(), size, size, masks);
+		}
+		double singleTime = (FPlatformTime::Seconds() - startTime) / iterations;
+
+		int32 mismatches = 0;
+		for (int32 i = 0; i < size * size; i++)
+		{
+			mismatches += masks[0][i] != referenceMask[i];
+		}
+
+		startTime = FPlatformTime::Seconds();
+		for (int32 k = 0; k < iterations; k++)
+		{
+			table.Classify(pixels.GetData(), size, size, masks);
+		}
+		double multiTime = (FPlatformTime::Seconds() - startTime) / iterations;
+
+		UE_LOG(LogTemp, Display, TEXT("    %d bits (%lld KB): 1 class %.3f us (build %.3f ms, %d mismatches), %d classes %.3f us (build %.3f ms)"),
+			bits, table.GetAllocatedSize() / 1024, singleTime * 1e6, singleBuildTime * 1e3, mismatches, classColors.Num(), multiTime * 1e6, buildTime * 1e3);
+	}
+}
+
+static FAutoConsoleCommand BenchmarkColorTableCommand(
+	TEXT("VV.Vision.BenchmarkColorTable"),
+	TEXT("Benchmarks classification with the color lookup table for 5, 6 and 7 bits per channel, with 1 and 4 classes, including the rebuild cost."),
+	FConsoleCommandDelegate::CreateStatic(&BenchmarkColorTable));
+
+// Returns the largest difference between two sets of features, relative for skewness values larger than 1
+static float FeaturesDifference(const FVisionFeatures& a, const FVisionFeatures& b)
+{
+	// When all the positive pixels are in the same column, the reference skewness is NaN and Compute gives 0
+	bool bUndefined = FMath::IsNaN(b.Skewness) && a.Skewness == 0.0f;
+	float skewnessDifference = bUndefined ? 0.0f : FMath::Abs(a.Skewness - b.Skewness) / FMath::Max(1.0f, FMath::Abs(b.Skewness));
+	return FMath::Max(FMath::Max(FMath::Abs(a.Coverage - b.Coverage), FMath::Abs(a.Mean - b.Mean)),
+		FMath::Max(FMath::Abs(a.StandardDeviation - b.StandardDeviation), skewnessDifference));
+}
+
+// Checks the fused feature extraction against the reference on masks of several sizes and shapes, and benchmarks both
+static void CheckFeatures()
+{
+	const FIntPoint sizes[] = { FIntPoint(16, 16), FIntPoint(64, 64), FIntPoint(100, 100), FIntPoint(256, 256), FIntPoint(1024, 1024), FIntPoint(128, 32), FIntPoint(320, 72) };
+	const float densities[] = { 0.0f, 0.05f, 0.3f, 0.9f };
+	const int32 workPerSize = 1 << 24; // Number of pixels processed for each size
+
+	FRandomStream random(0);
+	int32 numFailed = 0, numChecked = 0;
+	for (const FIntPoint& size : sizes)
+	{
+		int32 iterations = FMath::Max(1, workPerSize / (size.X * size.Y));
+		float maxDifference = 0.0f;
+		double referenceTime = 0.0, computeTime = 0.0;
+		for (int32 shape = 0; shape < 3; shape++)
+		{
+			for (float density : densities)
+			{
+				// Noise, a slanted band like the track, or a single column
+				FVisionMask mask;
+				mask.Init(size.X, size.Y);
+				float center = random.FRandRange(0.0f, size.X), halfWidth = random.FRandRange(1.0f, size.X * 0.5f);
+				for (int32 y = 0; y < size.Y; y++)
+				{
+					for (int32 x = 0; x < size.X; x++)
+					{
+						bool bInBand = FMath::Abs(x - center - 0.3f * y) < halfWidth;
+						bool bPositive = shape == 0 ? random.FRand() < density : shape == 1 ? bInBand && random.FRand() < density + 0.1f : x == (int32)center && random.FRand() < density;
+						mask.Set(y * size.X + x, bPositive);
+					}
+				}
+
+				FVisionFeatures reference, features;
+				double startTime = FPlatformTime::Seconds();
+				for (int32 k = 0; k < iterations; k++)
+				{
+					reference = FVisionFeatures::ComputeReference(mask);
+				}
+				referenceTime += FPlatformTime::Seconds() - startTime;
+
+				startTime = FPlatformTime::Seconds();
+				for (int32 k = 0; k < iterations; k++)
+				{
+					features = FVisionFeatures::Compute(mask);
+				}
+				computeTime += FPlatformTime::Seconds() - startTime;
+
+				float difference = FeaturesDifference(features, reference);
+				maxDifference = FMath::Max(maxDifference, difference);
+				++numChecked;
+				if (!(difference <= FVisionFeatures::Tolerance))
+				{
+					++numFailed;
+					UE_LOG(LogTemp, Warning, TEXT("Features differ for a %dx%d mask (shape %d, density %.2f): (%g, %g, %g, %g) instead of (%g, %g, %g, %g)"),
+						size.X, size.Y, shape, density, features.Coverage, features.Mean, features.StandardDeviation, features.Skewness,
+						reference.Coverage, reference.Mean, reference.StandardDeviation, reference.Skewness);
+				}
+			}
+		}
+
+		int32 numMasks = 3 * ARRAY_COUNT(densities);
+		UE_LOG(LogTemp, Display, TEXT("%4dx%-4d: features %9.3f us (reference %9.3f us, speedup %.2fx), max difference %g"),
+			size.X, size.Y, computeTime * 1e6 / (iterations * numMasks), referenceTime * 1e6 / (iterations * numMasks), referenceTime / computeTime, maxDifference);
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("Feature extraction check: %d of %d masks within tolerance."), numChecked - numFailed, numChecked);
+}
+
+static FAutoConsoleCommand CheckFeaturesCommand(
+	TEXT("VV.Vision.CheckFeatures"),
+	TEXT("Checks the fused feature extraction of ProcessCameraFeed against the original implementation, and benchmarks both."),
+	FConsoleCommandDelegate::CreateStatic(&CheckFeatures));
+
+static void BenchmarkSyntheticFeed()
+{
+	const int32 numFrames = 10000;
+	const float deltaTime = 1.0f / 60.0f;
+	TArray<FVisionClass> classes;
+	classes.AddDefaulted();
+	classes[0].Label = TEXT("Track");
+
+	UProceduralRoadFeedSource* source = NewObject<UProceduralRoadFeedSource>();
+	source->bFollowOwner = false;
+	source->Seed = 1;
+
+	// Generate the feeds, and compute their features like the pawn does
+	TArray<FVisionMask> masks;
+	masks.SetNum(classes.Num());
+	TArray<FVisionMask> firstMasks;
+	double generateTime = 0.0, featuresTime = 0.0, totalCoverage = 0.0;
+	for (int32 i = 0; i < numFrames; i++)
+	{
+		double startTime = FPlatformTime::Seconds();
+		source->GenerateFeeds(classes, deltaTime, masks);
+		generateTime += FPlatformTime::Seconds() - startTime;
+
+		startTime = FPlatformTime::Seconds();
+		totalCoverage += FVisionFeatures::Compute(masks[0]).Coverage;
+		featuresTime += FPlatformTime::Seconds() - startTime;
+
+		if (i < 100)
+		{
+			firstMasks.Add(masks[0]);
+		}
+	}
+
+	// The same seed must generate the same feeds
+	source->Reset();
+	int32 numDifferent = 0;
+	for (int32 i = 0; i < firstMasks.Num(); i++)
+	{
+		source->GenerateFeeds(classes, deltaTime, masks);
+		numDifferent += !(masks[0] == firstMasks[i]);
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("Procedural road %dx%d: generate %.3f us, features %.3f us, %.0f feeds per second, mean coverage %.3f"),
+		source->Width, source->Height, generateTime * 1e6 / numFrames, featuresTime * 1e6 / numFrames,
+		numFrames / FMath::Max(generateTime + featuresTime, 1e-9), totalCoverage / numFrames);
+	UE_LOG(LogTemp, Display, TEXT("Procedural road determinism check: %d of %d feeds differ after a reset."), numDifferent, firstMasks.Num());
+}
+
+static FAutoConsoleCommand BenchmarkSyntheticFeedCommand(
+	TEXT("VV.Vision.BenchmarkSyntheticFeed"),
+	TEXT("Benchmarks the procedural road feed source with its features, and checks that it generates the same feeds from the same seed."),
+	FConsoleCommandDelegate::CreateStatic(&BenchmarkSyntheticFeed));
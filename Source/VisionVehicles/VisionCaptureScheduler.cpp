@@ -0,0 +1,126 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "VisionVehicles.h"
+#include "VisionCaptureScheduler.h"
+
+FVisionCaptureScheduler& FVisionCaptureScheduler::Get()
+{
+	static FVisionCaptureScheduler scheduler;
+	return scheduler;
+}
+
+FVisionCaptureScheduler::FVisionCaptureScheduler()
+	: currentFrame(GFrameNumber), currentCaptures(0), currentFeedTime(0.0), numStatsFrames(0), nextStatsFrame(0), averageFrameTime(0.0f)
+{
+}
+
+int32 FVisionCaptureScheduler::Register()
+{
+	// Reuse the lowest free slot, so the slots in use stay evenly spread
+	int32 slot = usedSlots.Find(false);
+	if (slot == INDEX_NONE)
+	{
+		slot = usedSlots.Add(true);
+	}
+	usedSlots[slot] = true;
+	return slot;
+}
+
+void FVisionCaptureScheduler::Unregister(int32 slot)
+{
+	if (usedSlots.IsValidIndex(slot))
+	{
+		usedSlots[slot] = false;
+	}
+}
+
+int32 FVisionCaptureScheduler::GetCaptureInterval(float captureRate)
+{
+	UpdateFrame();
+	if (captureRate <= 0.0f || averageFrameTime <= 0.0f)
+	{
+		return 1;
+	}
+	return FMath::Max(1, FMath::RoundToInt(1.0f / (captureRate * averageFrameTime)));
+}
+
+bool FVisionCaptureScheduler::ShouldCapture(int32 slot, float captureRate)
+{
+	int32 interval = GetCaptureInterval(captureRate);
+	return (currentFrame + (uint32)FMath::Max(slot, 0)) % (uint32)interval == 0;
+}
+
+void FVisionCaptureScheduler::RecordCapture()
+{
+	UpdateFrame();
+	++currentCaptures;
+}
+
+void FVisionCaptureScheduler::RecordFeedTime(double seconds)
+{
+	UpdateFrame();
+	currentFeedTime += seconds;
+}
+
+FVisionCaptureScheduler::FStats FVisionCaptureScheduler::GetStats() const
+{
+	FStats stats;
+	for (bool bUsed : usedSlots)
+	{
+		stats.NumComponents += bUsed;
+	}
+	if (numStatsFrames == 0)
+	{
+		return stats;
+	}
+
+	stats.LastFrameCaptures = frameCaptures[(nextStatsFrame + StatsFrames - 1) % StatsFrames];
+	stats.MinCaptures = MAX_int32;
+	double totalCaptures = 0.0, totalFeedTime = 0.0, maxFeedTime = 0.0;
+	for (int32 i = 0; i < numStatsFrames; i++)
+	{
+		stats.MinCaptures = FMath::Min(stats.MinCaptures, frameCaptures[i]);
+		stats.MaxCaptures = FMath::Max(stats.MaxCaptures, frameCaptures[i]);
+		totalCaptures += frameCaptures[i];
+		totalFeedTime += frameFeedTimes[i];
+		maxFeedTime = FMath::Max(maxFeedTime, frameFeedTimes[i]);
+	}
+	stats.AverageCaptures = (float)(totalCaptures / numStatsFrames);
+	stats.AverageFeedTime = (float)(totalFeedTime * 1000.0 / numStatsFrames);
+	stats.MaxFeedTime = (float)(maxFeedTime * 1000.0);
+	return stats;
+}
+
+void FVisionCaptureScheduler::UpdateFrame()
+{
+	if (currentFrame == GFrameNumber)
+	{
+		return;
+	}
+
+	frameCaptures[nextStatsFrame] = currentCaptures;
+	frameFeedTimes[nextStatsFrame] = currentFeedTime;
+	nextStatsFrame = (nextStatsFrame + 1) % StatsFrames;
+	numStatsFrames = FMath::Min(numStatsFrames + 1, StatsFrames);
+	currentFrame = GFrameNumber;
+	currentCaptures = 0;
+	currentFeedTime = 0.0;
+
+	// Smooth the frame time, so the capture intervals don't change with every hitch
+	float deltaTime = (float)FApp::GetDeltaTime();
+	averageFrameTime = averageFrameTime > 0.0f ? FMath::Lerp(averageFrameTime, deltaTime, 0.1f) : deltaTime;
+}
+
+static void LogCaptureStats()
+{
+	FVisionCaptureScheduler::FStats stats = FVisionCaptureScheduler::Get().GetStats();
+	UE_LOG(LogTemp, Display, TEXT("Vision captures: %d components, %d captures in the last frame, %.2f per frame on average (min %d, max %d) over the last %d frames"),
+		stats.NumComponents, stats.LastFrameCaptures, stats.AverageCaptures, stats.MinCaptures, stats.MaxCaptures, FVisionCaptureScheduler::StatsFrames);
+	UE_LOG(LogTemp, Display, TEXT("Vision feed readback and classification: %.3f ms per frame on average, %.3f ms at most"),
+		stats.AverageFeedTime, stats.MaxFeedTime);
+}
+
+static FAutoConsoleCommand LogCaptureStatsCommand(
+	TEXT("VV.Vision.CaptureStats"),
+	TEXT("Logs how many vision components captured per frame over the last frames, and the time spent on their feeds per frame."),
+	FConsoleCommandDelegate::CreateStatic(&LogCaptureStats));
@@ -0,0 +1,77 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+/** Schedules the scene captures of the vision components, so each one captures at its own rate and the captures
+ *	of all the vehicles are spread over the frames.
+ *		A component that captures every k frames captures on the frames where (frame + slot) % k == 0, with the stagger slot
+ *		it was given when it began play. Slots are given in order, so with N components at most ceil(N / k) capture in the same frame.
+ *		It is only used from the game thread.
+ */
+class VISIONVEHICLES_API FVisionCaptureScheduler
+{
+public:
+	// The number of frames the stats are computed over
+	static const int32 StatsFrames = 64;
+
+	// The capture stats over the last StatsFrames frames
+	struct FStats
+	{
+		int32 NumComponents = 0;
+		int32 LastFrameCaptures = 0;
+		float AverageCaptures = 0.0f;
+		int32 MinCaptures = 0;
+		int32 MaxCaptures = 0;
+
+		// The time spent reading back and classifying the feeds, in milliseconds per frame
+		float AverageFeedTime = 0.0f;
+		float MaxFeedTime = 0.0f;
+	};
+
+	// Returns the scheduler
+	static FVisionCaptureScheduler& Get();
+
+	// Returns a stagger slot for a new component
+	int32 Register();
+
+	// Frees the stagger slot of a component
+	void Unregister(int32 slot);
+
+	// Returns the number of frames between captures for the given rate in captures per second, at the average frame rate. It is 1 if the rate is 0.
+	int32 GetCaptureInterval(float captureRate);
+
+	// Returns whether the component with the given stagger slot captures in the current frame, at the given rate
+	bool ShouldCapture(int32 slot, float captureRate);
+
+	// Records a capture in the current frame
+	void RecordCapture();
+
+	// Records time spent reading back and classifying a feed in the current frame
+	void RecordFeedTime(double seconds);
+
+	// Returns the stats over the last frames
+	FStats GetStats() const;
+
+private:
+	FVisionCaptureScheduler();
+
+	// Moves the stats of the last frame into the history when a new frame starts
+	void UpdateFrame();
+
+	// Whether each stagger slot is in use
+	TArray<bool> usedSlots;
+
+	// The frame number the current counts are for, and the captures and feed time in it
+	uint32 currentFrame;
+	int32 currentCaptures;
+	double currentFeedTime;
+
+	// The captures and feed time of the last frames, in a ring of StatsFrames entries
+	int32 frameCaptures[StatsFrames];
+	double frameFeedTimes[StatsFrames];
+	int32 numStatsFrames;
+	int32 nextStatsFrame;
+
+	// The average frame time, smoothed over the last frames
+	float averageFrameTime;
+};
@@ -0,0 +1,442 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "VisionVehicles.h"
+#include "VisionClassifier.h"
+
+#if PLATFORM_ENABLE_VECTORINTRINSICS_NEON
+#include <arm_neon.h>
+#define CLASSIFIER_USE_SIMD 1
+#elif PLATFORM_ENABLE_VECTORINTRINSICS
+#include <emmintrin.h>
+#define CLASSIFIER_USE_SIMD 1
+#else
+#define CLASSIFIER_USE_SIMD 0
+#endif
+
+// Classification without square roots or divisions.
+// Let c be the RGB of a pixel (0-255 per channel), k the normalized class color and t the threshold. Normalized colors
+// have length 1, so the squared distance between them is
+//	|c / |c| - k|^2 = 1 + |k|^2 - 2 (c.k) / |c|
+// which is below t^2 when (c.k) > a |c|, with a = (1 + |k|^2 - t^2) / 2. Squaring both sides, that is
+//	(c.k) > 0 && (c.k)^2 > a^2 |c|^2		when a >= 0
+//	(c.k) >= 0 || (c.k)^2 < a^2 |c|^2		when a < 0
+// Black pixels can't be normalized and stay black, so their squared distance is |k|^2.
+struct FClassifierParams
+{
+	// The normalized class color
+	float kR, kG, kB;
+
+	// a^2 and the sign of a
+	float aSquared;
+	bool bPositiveA;
+
+	// Whether black pixels belong to the class
+	bool bBlackInClass;
+
+	FClassifierParams(const FLinearColor& classColor, float distanceThreshold)
+	{
+		FLinearColor k = FVisionClassifier::ToNormalizedRGB(classColor);
+		kR = k.R;
+		kG = k.G;
+		kB = k.B;
+
+		float kSquared = kR * kR + kG * kG + kB * kB > 0.5f ? 1.0f : 0.0f; // 0 if the class color is black
+		float a = (1.0f + kSquared - distanceThreshold * distanceThreshold) * 0.5f;
+		aSquared = a * a;
+		bPositiveA = a >= 0.0f;
+		bBlackInClass = kSquared < distanceThreshold * distanceThreshold;
+	}
+};
+
+static FORCEINLINE bool ClassifyPixel(const FColor& pixel, const FClassifierParams& params)
+{
+	float r = pixel.R, g = pixel.G, b = pixel.B;
+	float dot = r * params.kR + g * params.kG + b * params.kB;
+	float lengthSquared = r * r + g * g + b * b;
+	if (lengthSquared == 0.0f)
+	{
+		return params.bBlackInClass;
+	}
+	float bound = params.aSquared * lengthSquared;
+	return params.bPositiveA ? (dot > 0.0f && dot * dot > bound) : (dot >= 0.0f || dot * dot < bound);
+}
+
+// The SIMD kernels classify 4 pixels at a time. FColor is stored as BGRA, so in each 32-bit lane
+// blue is in the lowest byte, then green and red.
+#if PLATFORM_ENABLE_VECTORINTRINSICS_NEON
+
+struct FSimdClassifierParams
+{
+	float32x4_t kR, kG, kB, aSquared, zero;
+	uint32x4_t positiveA, blackInClass, laneBits;
+
+	FSimdClassifierParams() {}
+	FSimdClassifierParams(const FClassifierParams& params)
+	{
+		static const uint32 bits[4] = { 1, 2, 4, 8 };
+		kR = vdupq_n_f32(params.kR);
+		kG = vdupq_n_f32(params.kG);
+		kB = vdupq_n_f32(params.kB);
+		aSquared = vdupq_n_f32(params.aSquared);
+		zero = vdupq_n_f32(0.0f);
+		positiveA = vdupq_n_u32(params.bPositiveA ? 0xFFFFFFFF : 0);
+		blackInClass = vdupq_n_u32(params.bBlackInClass ? 0xFFFFFFFF : 0);
+		laneBits = vld1q_u32(bits);
+	}
+};
+
+typedef float32x4_t FSimdFloats;
+
+// Loads the channels of 4 pixels
+static FORCEINLINE void LoadFourPixels(const FColor* pixels, FSimdFloats& r, FSimdFloats& g, FSimdFloats& b)
+{
+	uint32x4_t packed = vld1q_u32((const uint32*)pixels);
+	uint32x4_t byteMask = vdupq_n_u32(0xFF);
+	b = vcvtq_f32_u32(vandq_u32(packed, byteMask));
+	g = vcvtq_f32_u32(vandq_u32(vshrq_n_u32(packed, 8), byteMask));
+	r = vcvtq_f32_u32(vandq_u32(vshrq_n_u32(packed, 16), byteMask));
+}
+
+// Returns the classification of 4 pixels in the lowest 4 bits
+static FORCEINLINE uint32 ClassifyFourPixels(const FSimdFloats& r, const FSimdFloats& g, const FSimdFloats& b, const FSimdClassifierParams& params)
+{
+	float32x4_t dot = vaddq_f32(vaddq_f32(vmulq_f32(r, params.kR), vmulq_f32(g, params.kG)), vmulq_f32(b, params.kB));
+	float32x4_t lengthSquared = vaddq_f32(vaddq_f32(vmulq_f32(r, r), vmulq_f32(g, g)), vmulq_f32(b, b));
+	float32x4_t dotSquared = vmulq_f32(dot, dot);
+	float32x4_t bound = vmulq_f32(params.aSquared, lengthSquared);
+
+	uint32x4_t inClassPositiveA = vandq_u32(vcgtq_f32(dot, params.zero), vcgtq_f32(dotSquared, bound));
+	uint32x4_t inClassNegativeA = vorrq_u32(vcgeq_f32(dot, params.zero), vcltq_f32(dotSquared, bound));
+	uint32x4_t inClass = vbslq_u32(params.positiveA, inClassPositiveA, inClassNegativeA);
+	inClass = vbslq_u32(vceqq_f32(lengthSquared, params.zero), params.blackInClass, inClass);
+
+	// Gather the lane masks into bits
+	uint32x4_t bits = vandq_u32(inClass, params.laneBits);
+	uint32x2_t sum = vpadd_u32(vget_low_u32(bits), vget_high_u32(bits));
+	return vget_lane_u32(vpadd_u32(sum, sum), 0);
+}
+
+#elif PLATFORM_ENABLE_VECTORINTRINSICS
+
+struct FSimdClassifierParams
+{
+	__m128 kR, kG, kB, aSquared, zero, positiveA, blackInClass;
+
+	FSimdClassifierParams() {}
+	FSimdClassifierParams(const FClassifierParams& params)
+	{
+		kR = _mm_set1_ps(params.kR);
+		kG = _mm_set1_ps(params.kG);
+		kB = _mm_set1_ps(params.kB);
+		aSquared = _mm_set1_ps(params.aSquared);
+		zero = _mm_setzero_ps();
+		positiveA = _mm_castsi128_ps(_mm_set1_epi32(params.bPositiveA ? -1 : 0));
+		blackInClass = _mm_castsi128_ps(_mm_set1_epi32(params.bBlackInClass ? -1 : 0));
+	}
+};
+
+typedef __m128 FSimdFloats;
+
+// Loads the channels of 4 pixels
+static FORCEINLINE void LoadFourPixels(const FColor* pixels, FSimdFloats& r, FSimdFloats& g, FSimdFloats& b)
+{
+	__m128i packed = _mm_loadu_si128((const __m128i*)pixels);
+	__m128i byteMask = _mm_set1_epi32(0xFF);
+	b = _mm_cvtepi32_ps(_mm_and_si128(packed, byteMask));
+	g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(packed, 8), byteMask));
+	r = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(packed, 16), byteMask));
+}
+
+// Returns the classification of 4 pixels in the lowest 4 bits
+static FORCEINLINE uint32 ClassifyFourPixels(const FSimdFloats& r, const FSimdFloats& g, const FSimdFloats& b, const FSimdClassifierParams& params)
+{
+	__m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, params.kR), _mm_mul_ps(g, params.kG)), _mm_mul_ps(b, params.kB));
+	__m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(g, g)), _mm_mul_ps(b, b));
+	__m128 dotSquared = _mm_mul_ps(dot, dot);
+	__m128 bound = _mm_mul_ps(params.aSquared, lengthSquared);
+
+	__m128 inClassPositiveA = _mm_and_ps(_mm_cmpgt_ps(dot, params.zero), _mm_cmpgt_ps(dotSquared, bound));
+	__m128 inClassNegativeA = _mm_or_ps(_mm_cmpge_ps(dot, params.zero), _mm_cmplt_ps(dotSquared, bound));
+	__m128 inClass = _mm_or_ps(_mm_and_ps(params.positiveA, inClassPositiveA), _mm_andnot_ps(params.positiveA, inClassNegativeA));
+	__m128 isBlack = _mm_cmpeq_ps(lengthSquared, params.zero);
+	inClass = _mm_or_ps(_mm_and_ps(isBlack, params.blackInClass), _mm_andnot_ps(isBlack, inClass));
+
+	return _mm_movemask_ps(inClass);
+}
+
+#endif
+
+void FVisionClassifier::Classify(const FColor* pixels, int32 width, int32 height, const FLinearColor& classColor, float distanceThreshold, FVisionMask& mask)
+{
+	Classify(pixels, width, height, &classColor, &distanceThreshold, 1, &mask);
+}
+
+void FVisionClassifier::Classify(const FColor* pixels, int32 width, int32 height, const FLinearColor* classColors, const float* distanceThresholds, int32 numClasses, FVisionMask* masks)
+{
+	check(numClasses <= MaxClasses);
+
+	// Classes with no threshold are left empty
+	TArray<FClassifierParams, TInlineAllocator<MaxClasses>> params;
+	TArray<int32, TInlineAllocator<MaxClasses>> classIndices;
+	for (int32 c = 0; c < numClasses; c++)
+	{
+		masks[c].Init(width, height);
+		if (distanceThresholds[c] > 0.0f)
+		{
+			params.Add(FClassifierParams(classColors[c], distanceThresholds[c]));
+			classIndices.Add(c);
+		}
+	}
+	int32 numActiveClasses = params.Num();
+	int32 numPixels = width * height;
+	int32 firstScalarPixel = 0;
+
+#if CLASSIFIER_USE_SIMD
+	// Classify whole mask words, loading 16 pixels per step and classifying them for every class
+	FSimdClassifierParams simdParams[MaxClasses];
+	for (int32 c = 0; c < numActiveClasses; c++)
+	{
+		simdParams[c] = FSimdClassifierParams(params[c]);
+	}
+	int32 numFullWords = numPixels / 64;
+	for (int32 w = 0; w < numFullWords; w++)
+	{
+		const FColor* wordPixels = pixels + w * 64;
+		uint64 words[MaxClasses] = { 0 };
+		for (int32 i = 0; i < 64; i += 16)
+		{
+			FSimdFloats r[4], g[4], b[4];
+			for (int32 k = 0; k < 4; k++)
+			{
+				LoadFourPixels(wordPixels + i + k * 4, r[k], g[k], b[k]);
+			}
+			for (int32 c = 0; c < numActiveClasses; c++)
+			{
+				uint64 bits = ClassifyFourPixels(r[0], g[0], b[0], simdParams[c])
+					| ClassifyFourPixels(r[1], g[1], b[1], simdParams[c]) << 4
+					| ClassifyFourPixels(r[2], g[2], b[2], simdParams[c]) << 8
+					| ClassifyFourPixels(r[3], g[3], b[3], simdParams[c]) << 12;
+				words[c] |= bits << i;
+			}
+		}
+		for (int32 c = 0; c < numActiveClasses; c++)
+		{
+			masks[classIndices[c]].Words[w] = words[c];
+		}
+	}
+	firstScalarPixel = numFullWords * 64;
+#endif
+
+	// Classify the remaining pixels
+	for (int32 i = firstScalarPixel; i < numPixels; i++)
+	{
+		for (int32 c = 0; c < numActiveClasses; c++)
+		{
+			if (ClassifyPixel(pixels[i], params[c]))
+			{
+				masks[classIndices[c]].Words[i >> 6] |= (uint64)1 << (i & 63);
+			}
+		}
+	}
+}
+
+void FVisionClassifier::BuildLabels(const FVisionMask* masks, int32 numClasses, TArray<uint8>& labels)
+{
+	int32 numPixels = numClasses > 0 ? masks[0].Num() : 0;
+	labels.Reset();
+	labels.SetNumZeroed(numPixels);
+
+	// Write the classes in reverse order, so the first class a pixel belongs to is the one kept
+	for (int32 c = numClasses - 1; c >= 0; c--)
+	{
+		for (int32 w = 0; w < masks[c].Words.Num(); w++)
+		{
+			uint64 word = masks[c].Words[w];
+			for (int32 i = 0; word != 0; i++, word >>= 1)
+			{
+				if (word & 1)
+				{
+					labels[w * 64 + i] = c + 1;
+				}
+			}
+		}
+	}
+}
+
+void FVisionClassifier::ClassifyReference(const FColor* pixels, int32 width, int32 height, const FLinearColor& classColor, float distanceThreshold, FVisionMask& mask)
+{
+	mask.Init(width, height);
+	FLinearColor normalizedClassColor = ToNormalizedRGB(classColor);
+	int32 numPixels = width * height;
+	for (int32 i = 0; i < numPixels; i++)
+	{
+		// Use euclidean distance between normalized colors to determine if it belongs to the class
+		if (FLinearColor::Dist(ToNormalizedRGB(pixels[i].ReinterpretAsLinear()), normalizedClassColor) < distanceThreshold)
+		{
+			mask.Set(i, true);
+		}
+	}
+}
+
+void FVisionClassifier::DownsampleBox(const FColor* pixels, int32 width, int32 height, int32 factor, TArray<FColor>& result)
+{
+	int32 resultWidth = width / factor, resultHeight = height / factor;
+	result.SetNumUninitialized(resultWidth * resultHeight);
+
+	// Sum the channels of each row of blocks, reading the pixels row by row
+	TArray<uint32> sums;
+	uint32 blockSize = factor * factor;
+	for (int32 by = 0; by < resultHeight; by++)
+	{
+		sums.Reset();
+		sums.SetNumZeroed(resultWidth * 4);
+		for (int32 y = by * factor; y < (by + 1) * factor; y++)
+		{
+			const FColor* row = pixels + y * width;
+			for (int32 x = 0; x < resultWidth * factor; x++)
+			{
+				uint32* sum = &sums[x / factor * 4];
+				sum[0] += row[x].R;
+				sum[1] += row[x].G;
+				sum[2] += row[x].B;
+				sum[3] += row[x].A;
+			}
+		}
+		for (int32 bx = 0; bx < resultWidth; bx++)
+		{
+			const uint32* sum = &sums[bx * 4];
+			result[by * resultWidth + bx] = FColor(
+				(sum[0] + blockSize / 2) / blockSize, (sum[1] + blockSize / 2) / blockSize, (sum[2] + blockSize / 2) / blockSize, (sum[3] + blockSize / 2) / blockSize);
+		}
+	}
+}
+
+void FVisionClassifier::DownsampleMajority(const FVisionMask& mask, int32 factor, FVisionMask& result)
+{
+	int32 resultWidth = mask.Width / factor, resultHeight = mask.Height / factor;
+	result.Init(resultWidth, resultHeight);
+	result.FrameId = mask.FrameId;
+
+	// Count the positive pixels of each row of blocks, reading the mask row by row
+	TArray<int32> counts;
+	int32 majority = factor * factor / 2;
+	for (int32 by = 0; by < resultHeight; by++)
+	{
+		counts.Reset();
+		counts.SetNumZeroed(resultWidth);
+		for (int32 y = by * factor; y < (by + 1) * factor; y++)
+		{
+			int32 rowStart = y * mask.Width;
+			for (int32 x = 0; x < resultWidth * factor; x++)
+			{
+				counts[x / factor] += mask[rowStart + x];
+			}
+		}
+		for (int32 bx = 0; bx < resultWidth; bx++)
+		{
+			if (counts[bx] > majority)
+			{
+				result.Set(by * resultWidth + bx, true);
+			}
+		}
+	}
+}
+
+FLinearColor FVisionClassifier::ToNormalizedRGB(const FLinearColor& color)
+{
+	FVector colorAsVector(color.R, color.G, color.B);
+	colorAsVector.Normalize();
+	return FLinearColor(colorAsVector.X, colorAsVector.Y, colorAsVector.Z, 1.0f);
+}
+
+FVisionColorTable::FVisionColorTable()
+{
+	bitsPerChannel = 0;
+}
+
+double FVisionColorTable::Build(const TArray<FLinearColor>& _classColors, const TArray<float>& _distanceThresholds, int32 _bitsPerChannel)
+{
+	check(_classColors.Num() == _distanceThresholds.Num() && _classColors.Num() <= MaxClasses);
+	double startTime = FPlatformTime::Seconds();
+
+	classColors = _classColors;
+	distanceThresholds = _distanceThresholds;
+	bitsPerChannel = FMath::Clamp(_bitsPerChannel, MinBitsPerChannel, MaxBitsPerChannel);
+
+	TArray<FClassifierParams> params;
+	for (int32 c = 0; c < classColors.Num(); c++)
+	{
+		params.Add(FClassifierParams(classColors[c], distanceThresholds[c]));
+	}
+
+	// Classify the center of the quantization cell of each entry
+	int32 numLevels = 1 << bitsPerChannel;
+	int32 shift = 8 - bitsPerChannel;
+	int32 halfCell = 1 << shift >> 1;
+	entries.SetNumUninitialized(numLevels * numLevels * numLevels);
+	uint8* entry = entries.GetData();
+	for (int32 r = 0; r < numLevels; r++)
+	{
+		for (int32 g = 0; g < numLevels; g++)
+		{
+			for (int32 b = 0; b < numLevels; b++)
+			{
+				FColor color((r << shift) + halfCell, (g << shift) + halfCell, (b << shift) + halfCell);
+				uint8 classBits = 0;
+				for (int32 c = 0; c < params.Num(); c++)
+				{
+					bool bInClass = distanceThresholds[c] > 0.0f && ClassifyPixel(color, params[c]);
+					classBits |= (uint8)bInClass << c;
+				}
+				*entry++ = classBits;
+			}
+		}
+	}
+
+	return FPlatformTime::Seconds() - startTime;
+}
+
+bool FVisionColorTable::IsBuiltFor(const TArray<FLinearColor>& _classColors, const TArray<float>& _distanceThresholds, int32 _bitsPerChannel) const
+{
+	return entries.Num() > 0 && classColors == _classColors && distanceThresholds == _distanceThresholds
+		&& bitsPerChannel == FMath::Clamp(_bitsPerChannel, MinBitsPerChannel, MaxBitsPerChannel);
+}
+
+void FVisionColorTable::Classify(const FColor* pixels, int32 width, int32 height, FVisionMask* masks) const
+{
+	int32 numClasses = classColors.Num();
+	for (int32 c = 0; c < numClasses; c++)
+	{
+		masks[c].Init(width, height);
+	}
+
+	// The table index is built directly from the packed BGRA value
+	const uint32* packedPixels = (const uint32*)pixels;
+	const uint8* table = entries.GetData();
+	uint32 shift = 8 - bitsPerChannel;
+	uint32 levelMask = (1 << bitsPerChannel) - 1;
+	uint32 gShift = bitsPerChannel, rShift = 2 * bitsPerChannel;
+
+	int32 numPixels = width * height;
+	int32 numWords = (numPixels + 63) / 64;
+	for (int32 w = 0; w < numWords; w++)
+	{
+		int32 first = w * 64;
+		int32 count = FMath::Min(64, numPixels - first);
+		uint64 words[MaxClasses] = { 0 };
+		for (int32 i = 0; i < count; i++)
+		{
+			uint32 packed = packedPixels[first + i];
+			uint32 index = (((packed >> (16 + shift)) & levelMask) << rShift) | (((packed >> (8 + shift)) & levelMask) << gShift) | ((packed >> shift) & levelMask);
+			uint64 classBits = table[index];
+			for (int32 c = 0; c < numClasses; c++)
+			{
+				words[c] |= ((classBits >> c) & 1) << i;
+			}
+		}
+		for (int32 c = 0; c < numClasses; c++)
+		{
+			masks[c].Words[w] = words[c];
+		}
+	}
+}
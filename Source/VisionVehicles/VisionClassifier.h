@@ -0,0 +1,86 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "VisionMask.h"
+
+/** Pixel classifiers used by the vision component.
+ *		A pixel belongs to the class if the euclidean distance between its normalized RGB and the normalized class color
+ *		is below the threshold. Normalizing removes the luminosity of the colors, so shadows and bright spots don't matter.
+ */
+struct VISIONVEHICLES_API FVisionClassifier
+{
+	// The maximum number of classes classified at once
+	static const int32 MaxClasses = 8;
+
+	/* Classifies the pixels of a BGRA8 image into the mask.
+	 *	It processes 16 pixels per step with SSE2 on x86 and NEON on ARM, and writes each 64-bit mask word once.
+	 *	It compares squared quantities only, without square roots or divisions (see the .cpp), and matches
+	 *	ClassifyReference except for colors within float rounding of the threshold. */
+	static void Classify(const FColor* pixels, int32 width, int32 height, const FLinearColor& classColor, float distanceThreshold, FVisionMask& mask);
+
+	// Classifies the pixels of a BGRA8 image for several classes in a single pass, into one mask per class
+	static void Classify(const FColor* pixels, int32 width, int32 height, const FLinearColor* classColors, const float* distanceThresholds, int32 numClasses, FVisionMask* masks);
+
+	// Builds a label per pixel from the masks of several classes: 0 if it belongs to no class, or 1 + the index of the first class it belongs to
+	static void BuildLabels(const FVisionMask* masks, int32 numClasses, TArray<uint8>& labels);
+
+	// Classifies the pixels one at a time, the way the vision component originally did
+	static void ClassifyReference(const FColor* pixels, int32 width, int32 height, const FLinearColor& classColor, float distanceThreshold, FVisionMask& mask);
+
+	/* Downsamples an image by averaging each block of factor x factor pixels.
+	 *	The result is (width / factor) x (height / factor), and the pixels past the last whole block are dropped. */
+	static void DownsampleBox(const FColor* pixels, int32 width, int32 height, int32 factor, TArray<FColor>& result);
+
+	/* Downsamples a mask, so each block of factor x factor pixels is positive if more than half of its pixels are.
+	 *	The result has the same size as with DownsampleBox. */
+	static void DownsampleMajority(const FVisionMask& mask, int32 factor, FVisionMask& result);
+
+	/* Converts a color to normalized RGB format.
+	 * This removes the luminosity of a color, making it the same regardless of shadows or bright spots. */
+	static FLinearColor ToNormalizedRGB(const FLinearColor& color);
+};
+
+/** A lookup table that classifies colors for several classes at once.
+ *		The RGB of a pixel is quantized to 'bitsPerChannel' bits per channel, and the table has one byte per quantized color,
+ *		where bit c is the classification for class c. Classifying a pixel is then a few shifts and a load.
+ *		Each entry is classified like FVisionClassifier::Classify would classify the center of its quantization cell,
+ *		so pixels close to the threshold may be classified differently.
+ */
+class VISIONVEHICLES_API FVisionColorTable
+{
+public:
+	// The maximum number of classes in a table
+	static const int32 MaxClasses = FVisionClassifier::MaxClasses;
+
+	// The range of quantization bits per channel. 5 bits is a 32 KB table, and 7 bits is a 2 MB table.
+	static const int32 MinBitsPerChannel = 5;
+	static const int32 MaxBitsPerChannel = 7;
+
+	FVisionColorTable();
+
+	/* Builds the table for the given class colors and distance thresholds, which must have the same size, up to MaxClasses.
+	 *	Returns the time it took in seconds. */
+	double Build(const TArray<FLinearColor>& _classColors, const TArray<float>& _distanceThresholds, int32 _bitsPerChannel);
+
+	// Returns whether the table was built with the given settings, so it doesn't need to be rebuilt
+	bool IsBuiltFor(const TArray<FLinearColor>& _classColors, const TArray<float>& _distanceThresholds, int32 _bitsPerChannel) const;
+
+	// Classifies the pixels of a BGRA8 image into one mask per class
+	void Classify(const FColor* pixels, int32 width, int32 height, FVisionMask* masks) const;
+
+	// Returns the number of classes in the table
+	FORCEINLINE int32 NumClasses() const { return classColors.Num(); }
+
+	// Returns the size of the table in bytes
+	FORCEINLINE int64 GetAllocatedSize() const { return entries.GetAllocatedSize(); }
+
+private:
+	// The class bits of each quantized color, indexed by (R << 2b) | (G << b) | B, with b bits per channel
+	TArray<uint8> entries;
+
+	// The settings the table was built for
+	TArray<FLinearColor> classColors;
+	TArray<float> distanceThresholds;
+	int32 bitsPerChannel;
+};
@@ -0,0 +1,148 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "VisionVehicles.h"
+#include "VisionFeatures.h"
+
+const float FVisionFeatures::Tolerance = 1e-4f;
+
+FVisionFeatures FVisionFeatures::Compute(const FVisionMask& mask)
+{
+	FVisionFeatures features;
+	int32 width = mask.Width;
+	if (mask.Num() == 0)
+	{
+		return features;
+	}
+
+	// Count the positive pixels of each column with bit-sliced counters, in row-major order. Plane k of each chunk of 64 columns
+	// holds bit k of the counts of its columns, and each row of the chunk is added to the planes with a ripple carry,
+	// so the cost doesn't depend on how many pixels are positive.
+	int32 numChunks = (width + 63) / 64;
+	int32 numPlanes = FMath::FloorLog2((uint32)mask.Height) + 1;
+	TArray<uint64, TInlineAllocator<256>> planes;
+	planes.SetNumZeroed(numChunks * numPlanes);
+	for (int32 y = 0; y < mask.Height; y++)
+	{
+		for (int32 c = 0; c < numChunks; c++)
+		{
+			// Read the bits of the chunk in this row, which can straddle two words
+			int64 firstBit = (int64)y * width + c * 64;
+			int32 numBits = FMath::Min(64, width - c * 64);
+			int32 shift = (int32)(firstBit & 63);
+			const uint64* words = mask.Words.GetData() + (firstBit >> 6);
+			uint64 bits = words[0] >> shift;
+			if (shift != 0 && shift + numBits > 64)
+			{
+				bits |= words[1] << (64 - shift);
+			}
+			bits = numBits < 64 ? bits & (((uint64)1 << numBits) - 1) : bits;
+
+			uint64* chunkPlanes = planes.GetData() + c * numPlanes;
+			for (int32 k = 0; bits != 0; k++)
+			{
+				uint64 carry = chunkPlanes[k] & bits;
+				chunkPlanes[k] ^= bits;
+				bits = carry;
+			}
+		}
+	}
+
+	// Read the count of each column out of the planes, and sum them into the number of positive pixels
+	TArray<int32, TInlineAllocator<1024>> columnCounts;
+	columnCounts.SetNumZeroed(width);
+	int64 totalCount = 0;
+	for (int32 x = 0; x < width; x++)
+	{
+		const uint64* chunkPlanes = planes.GetData() + (x >> 6) * numPlanes;
+		int32 count = 0;
+		for (int32 k = 0; k < numPlanes; k++)
+		{
+			count |= (int32)((chunkPlanes[k] >> (x & 63)) & 1) << k;
+		}
+		columnCounts[x] = count;
+		totalCount += count;
+	}
+	if (totalCount == 0)
+	{
+		return features;
+	}
+
+	// Raw moments from the integer counts, and central moments around the mean
+	int64 sum = 0;
+	for (int32 x = 0; x < width; x++)
+	{
+		sum += (int64)x * columnCounts[x];
+	}
+	double mean = (double)sum / totalCount;
+	double variance = 0.0, thirdMoment = 0.0;
+	for (int32 x = 0; x < width; x++)
+	{
+		double deviation = x - mean;
+		double weight = (double)columnCounts[x] / totalCount;
+		variance += deviation * deviation * weight;
+		thirdMoment += deviation * deviation * deviation * weight;
+	}
+	double standardDeviation = FMath::Sqrt(variance);
+
+	features.Coverage = (float)((double)totalCount / mask.Num());
+	features.Mean = (float)(mean / width);
+	features.StandardDeviation = (float)(standardDeviation / width);
+	// The skewness is undefined when all the positive pixels are in one column, and 0 is given to the NN instead of NaN
+	features.Skewness = variance > 0.0 ? (float)(thirdMoment / (variance * standardDeviation)) : 0.0f;
+	return features;
+}
+
+FVisionFeatures FVisionFeatures::ComputeReference(const FVisionMask& feed)
+{
+	// Compute the vertical projection histogram of the image
+	TArray<float> verticalProjectionHistogram;
+	int n = feed.Width;
+	int totalCount = 0;
+	for (int j = 0; j < n; j++)
+	{
+		int columnCount = 0;
+		for (int i = 0; i < feed.Height; i++)
+		{
+			if (feed[i * n + j])
+			{
+				++columnCount;
+				++totalCount;
+			}
+		}
+		verticalProjectionHistogram.Add(columnCount);
+	}
+	for (int i = 0; i < n; i++)
+	{
+		verticalProjectionHistogram[i] /= totalCount;
+	}
+
+	// Compute the inputs from the vertical projection histogram
+	float t = 0.0f, m = 0.5f, s = 0.0f, sk = 0.0f;
+	if (totalCount > 0)
+	{
+		m = 0.0f;
+		for (int i = 0; i < n; i++)
+		{
+			m += i * verticalProjectionHistogram[i];
+		}
+		for (int i = 0; i < n; i++)
+		{
+			s += FMath::Pow(i - m, 2.0f) * verticalProjectionHistogram[i];
+			sk += FMath::Pow(i - m, 3.0f) * verticalProjectionHistogram[i];
+		}
+
+		s = FMath::Sqrt(s);
+		sk = sk / FMath::Pow(s, 3.0f);
+
+		t = (float)totalCount / feed.Num();
+		m = m / n;
+		s = s / n;
+	}
+
+	FVisionFeatures features;
+	features.Coverage = t;
+	features.Mean = m;
+	features.StandardDeviation = s;
+	features.Skewness = sk;
+	return features;
+}
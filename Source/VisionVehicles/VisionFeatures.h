@@ -0,0 +1,36 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "VisionMask.h"
+
+/** The features of a classified camera feed used as inputs of the neural network.
+ *		They describe the vertical projection histogram of the mask (the number of positive pixels in each column),
+ *		as a distribution over the columns.
+ */
+struct VISIONVEHICLES_API FVisionFeatures
+{
+	/* Maximum difference between the features computed by Compute and ComputeReference, for masks of up to 1024x1024.
+	 *	It is absolute for the coverage, mean and standard deviation, and relative for skewness values larger than 1. */
+	static const float Tolerance;
+
+	// The fraction of positive pixels
+	float Coverage = 0.0f;
+
+	// The mean column of the positive pixels, divided by the width
+	float Mean = 0.5f;
+
+	// The standard deviation of the columns of the positive pixels, divided by the width
+	float StandardDeviation = 0.0f;
+
+	// The skewness of the columns of the positive pixels, or 0 if they are all in the same column
+	float Skewness = 0.0f;
+
+	/* Computes the features in a single row-major pass over the packed mask words.
+	 *	The counts of each column are accumulated 64 columns at a time with bit-sliced counters, whatever the density of the mask,
+	 *	and the number of positive pixels is their sum. The moments are computed from the integer counts. */
+	static FVisionFeatures Compute(const FVisionMask& mask);
+
+	// Computes the features the way the pawn originally did, walking the mask column by column. Its skewness is NaN when Compute gives 0.
+	static FVisionFeatures ComputeReference(const FVisionMask& mask);
+};
@@ -0,0 +1,138 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "VisionVehicles.h"
+#include "VisionFeedSource.h"
+
+UProceduralRoadFeedSource::UProceduralRoadFeedSource()
+{
+	// Set defaults, with the camera where the pawn mounts its vision component
+	Width = 64;
+	Height = 64;
+	RoadClass = TEXT("Track");
+	FieldOfView = 90.0f;
+	CameraPitch = -30.0f;
+	CameraHeight = 180.0f;
+	CameraForwardOffset = 150.0f;
+	RoadWidth = 600.0f;
+	ViewDistance = 5000.0f;
+	MaxCurvature = 1.0f / 3000.0f;
+	CurvatureChangeDistance = 4000.0f;
+	bFollowOwner = true;
+	Speed = 1500.0f;
+	Seed = 0;
+
+	lateralOffset = 0.0f;
+	headingError = 0.0f;
+	curvature = targetCurvature = 0.0f;
+	distanceToChange = 0.0f;
+	bIsReset = false;
+}
+
+void UProceduralRoadFeedSource::GenerateFeeds(const TArray<FVisionClass>& classes, float deltaTime, TArray<FVisionMask>& masks)
+{
+	Advance(deltaTime);
+
+	int32 roadClass = RoadClass.IsNone() ? INDEX_NONE : classes.IndexOfByPredicate([&](const FVisionClass& visionClass) { return visionClass.Label == RoadClass; });
+	roadClass = FMath::Max(roadClass, 0);
+	for (int32 c = 0; c < masks.Num(); c++)
+	{
+		if (c == roadClass)
+		{
+			Rasterize(masks[c]);
+		}
+		else
+		{
+			masks[c].Init(Width, Height);
+		}
+	}
+}
+
+void UProceduralRoadFeedSource::Reset()
+{
+	random.Initialize(Seed);
+	lateralOffset = 0.0f;
+	headingError = 0.0f;
+	curvature = 0.0f;
+	targetCurvature = random.FRandRange(-MaxCurvature, MaxCurvature);
+	distanceToChange = CurvatureChangeDistance;
+	bIsReset = true;
+}
+
+void UProceduralRoadFeedSource::Rasterize(FVisionMask& mask) const
+{
+	mask.Init(Width, Height);
+
+	float tanHalfFieldOfView = FMath::Tan(FMath::DegreesToRadians(FMath::Clamp(FieldOfView, 1.0f, 170.0f)) * 0.5f);
+	float sinPitch, cosPitch;
+	FMath::SinCos(&sinPitch, &cosPitch, FMath::DegreesToRadians(CameraPitch));
+	float halfRoadWidth = RoadWidth * 0.5f;
+	for (int32 y = 0; y < Height; y++)
+	{
+		// The rays of the row are forward + u * right + v * up in camera space, where the field of view is horizontal
+		float v = (1.0f - 2.0f * (y + 0.5f) / Height) * tanHalfFieldOfView * Height / Width;
+		float down = -(sinPitch + v * cosPitch);
+		if (down <= 0.0f)
+		{
+			// The row is at or above the horizon
+			continue;
+		}
+
+		// The rays hit the ground at 'distance' in front of the camera, and at t * u to the right
+		float t = CameraHeight / down;
+		float distance = t * (cosPitch - v * sinPitch);
+		if (distance > ViewDistance)
+		{
+			continue;
+		}
+
+		// The center of the road at that distance, relative to the vehicle, with small angle approximations
+		float x = distance + CameraForwardOffset;
+		float center = -lateralOffset - headingError * x + 0.5f * curvature * x * x;
+
+		// The road is the span of columns whose rays hit the ground within half the road width of its center
+		float uMin = (center - halfRoadWidth) / t, uMax = (center + halfRoadWidth) / t;
+		int32 first = FMath::Max(FMath::CeilToInt((uMin / tanHalfFieldOfView + 1.0f) * Width * 0.5f - 0.5f), 0);
+		int32 last = FMath::Min(FMath::FloorToInt((uMax / tanHalfFieldOfView + 1.0f) * Width * 0.5f - 0.5f), Width - 1);
+		mask.SetRange(y * Width + first, y * Width + last + 1, true);
+	}
+}
+
+void UProceduralRoadFeedSource::Advance(float deltaTime)
+{
+	if (!bIsReset)
+	{
+		Reset();
+	}
+	if (deltaTime <= 0.0f)
+	{
+		return;
+	}
+
+	// Move with the vehicle if there is one. A positive yaw rate turns right, like the curvature.
+	float speed = Speed, yawRate = 0.0f;
+	if (bFollowOwner)
+	{
+		UVehicleVisionComponent* component = GetTypedOuter<UVehicleVisionComponent>();
+		AActor* owner = component != nullptr ? component->GetOwner() : nullptr;
+		UPrimitiveComponent* root = owner != nullptr ? Cast<UPrimitiveComponent>(owner->GetRootComponent()) : nullptr;
+		if (root != nullptr)
+		{
+			speed = FVector::DotProduct(root->GetPhysicsLinearVelocity(), owner->GetActorForwardVector());
+			yawRate = FMath::DegreesToRadians(root->GetPhysicsAngularVelocity().Z);
+		}
+	}
+
+	// The vehicle turns relative to the road as much as it turns more than the road does
+	float distance = FMath::Abs(speed * deltaTime);
+	headingError = FMath::Clamp(headingError + (yawRate - curvature * speed) * deltaTime, -HALF_PI, HALF_PI);
+	lateralOffset += speed * FMath::Sin(headingError) * deltaTime;
+
+	// Ease the curvature to its target, and pick a new target after every CurvatureChangeDistance
+	curvature = FMath::Lerp(curvature, targetCurvature, FMath::Min(distance / FMath::Max(CurvatureChangeDistance, 1.0f), 1.0f));
+	distanceToChange -= distance;
+	if (distanceToChange <= 0.0f)
+	{
+		targetCurvature = random.FRandRange(-MaxCurvature, MaxCurvature);
+		distanceToChange = FMath::Max(distanceToChange + CurvatureChangeDistance, 0.0f);
+	}
+}
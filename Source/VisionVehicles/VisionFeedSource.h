@@ -0,0 +1,117 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "VehicleVisionComponent.h"
+#include "VisionFeedSource.generated.h"
+
+/* A source of classified camera feeds for a vision component, used instead of reading back its render target.
+ * Sources generate the mask of each class directly, so they don't need a renderer or a GPU. */
+UCLASS(Abstract, EditInlineNew, DefaultToInstanced, BlueprintType, ClassGroup = Vision)
+class VISIONVEHICLES_API UVisionFeedSource : public UObject
+{
+	GENERATED_BODY()
+
+public:
+	/* Generates the classified feed of each of the classes into the masks, which have one entry per class.
+	 * The time is the time elapsed since the last feed was generated, or 0 to generate the same feed again with other classes. */
+	virtual void GenerateFeeds(const TArray<FVisionClass>& classes, float deltaTime, TArray<FVisionMask>& masks) PURE_VIRTUAL(UVisionFeedSource::GenerateFeeds, );
+};
+
+/* A feed source that rasterizes a procedural road seen from the vision camera of a vehicle.
+ *	The road is an arc of slowly changing curvature on flat ground, and the camera is placed like the vision component of the pawn.
+ *	When it follows its owner, the vehicle's speed and yaw rate move the camera along and across the road, so steering changes
+ *	what the vehicle sees. Otherwise it drives along the center of the road at a constant speed.
+ *	The same seed generates the same feeds. Each row of the mask is filled as a single span, so it runs at thousands of frames per second. */
+UCLASS(ClassGroup = Vision, meta = (DisplayName = "Procedural Road"))
+class VISIONVEHICLES_API UProceduralRoadFeedSource : public UVisionFeedSource
+{
+	GENERATED_BODY()
+
+public:
+	/* The size of the generated feed in pixels.*/
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1"))
+	int32 Width;
+
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1"))
+	int32 Height;
+
+	/* The label of the class the road is classified as. If it is none or not found, the road is in the first class.*/
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite)
+	FName RoadClass;
+
+	/* The horizontal field of view of the camera, in degrees.*/
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1", ClampMax = "170"))
+	float FieldOfView;
+
+	/* The pitch of the camera, in degrees. It is negative when it looks down.*/
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "-89", ClampMax = "0"))
+	float CameraPitch;
+
+	/* The height of the camera above the road, and its distance in front of the center of the vehicle, in centimeters.*/
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1"))
+	float CameraHeight;
+
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite)
+	float CameraForwardOffset;
+
+	/* The width of the road, and the distance past which it isn't visible, in centimeters.*/
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	float RoadWidth;
+
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	float ViewDistance;
+
+	/* The largest curvature of the road, as the inverse of its radius in centimeters, and the distance after which it changes curvature.*/
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "0"))
+	float MaxCurvature;
+
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite, meta = (ClampMin = "1"))
+	float CurvatureChangeDistance;
+
+	/* Whether the camera moves with the vehicle that owns the vision component. Otherwise it drives along the road at Speed.*/
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite)
+	bool bFollowOwner;
+
+	/* The speed along the road when the camera doesn't follow its owner, in centimeters per second.*/
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite)
+	float Speed;
+
+	/* The seed of the random curvature changes.*/
+	UPROPERTY(Category = "Vision|Procedural Road", EditAnywhere, BlueprintReadWrite)
+	int32 Seed;
+
+	UProceduralRoadFeedSource();
+
+	// Begin UVisionFeedSource interface
+	virtual void GenerateFeeds(const TArray<FVisionClass>& classes, float deltaTime, TArray<FVisionMask>& masks) override;
+	// End UVisionFeedSource interface
+
+	/* Puts the camera back at the center of the start of the road.*/
+	UFUNCTION(BlueprintCallable, Category = Vision)
+	void Reset();
+
+	/* Rasterizes the road as it is now into the mask, which is initialized to the feed size.*/
+	void Rasterize(FVisionMask& mask) const;
+
+	/* Moves the camera along the road by the given time. */
+	void Advance(float deltaTime);
+
+private:
+	/* The distance of the vehicle from the center of the road, positive to the right, in centimeters */
+	float lateralOffset;
+
+	/* The angle between the vehicle and the road, positive to the right, in radians */
+	float headingError;
+
+	/* The current curvature of the road, the curvature it is changing to, and the distance left until it changes again */
+	float curvature;
+	float targetCurvature;
+	float distanceToChange;
+
+	/* The random stream of the curvature changes */
+	FRandomStream random;
+
+	/* Whether Reset has been called since the properties were set */
+	bool bIsReset;
+};
@@ -0,0 +1,130 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+/** A classified camera image, packed as one bit per pixel.
+ *		Pixels are in row-major order, and pixel i is bit (i % 64) of word (i / 64).
+ *		Bits past the last pixel are always zero, so masks can be compared and counted word by word.
+ */
+struct FVisionMask
+{
+	// The packed classification of the pixels
+	TArray<uint64> Words;
+
+	// The size of the image in pixels
+	int32 Width = 0;
+	int32 Height = 0;
+
+	// The frame number the image was captured in
+	uint32 FrameId = 0;
+
+	// Sets the size of the image, with all pixels negatively classified
+	void Init(int32 width, int32 height)
+	{
+		Width = width;
+		Height = height;
+		Words.Reset();
+		Words.SetNumZeroed((width * height + 63) / 64);
+	}
+
+	// Returns the number of pixels
+	FORCEINLINE int32 Num() const { return Width * Height; }
+
+	// Returns the classification of the pixel with the given index
+	FORCEINLINE bool operator[](int32 index) const { return (Words[index >> 6] >> (index & 63)) & 1; }
+
+	// Returns the classification of the pixel at the given coordinates
+	FORCEINLINE bool Get(int32 x, int32 y) const { return (*this)[y * Width + x]; }
+
+	// Sets the classification of the pixel with the given index
+	FORCEINLINE void Set(int32 index, bool value)
+	{
+		uint64 bit = (uint64)1 << (index & 63);
+		Words[index >> 6] = value ? Words[index >> 6] | bit : Words[index >> 6] & ~bit;
+	}
+
+	// Sets the classification of the pixels with an index in [first, end), a word at a time
+	void SetRange(int32 first, int32 end, bool value)
+	{
+		if (end <= first)
+		{
+			return;
+		}
+		int32 firstWord = first >> 6, lastWord = (end - 1) >> 6;
+		uint64 firstMask = ~(uint64)0 << (first & 63);
+		uint64 lastMask = ~(uint64)0 >> (63 - ((end - 1) & 63));
+		for (int32 w = firstWord; w <= lastWord; w++)
+		{
+			uint64 bits = (w == firstWord ? firstMask : ~(uint64)0) & (w == lastWord ? lastMask : ~(uint64)0);
+			Words[w] = value ? Words[w] | bits : Words[w] & ~bits;
+		}
+	}
+
+	// Returns the number of positive pixels
+	int32 CountPositive() const
+	{
+		int32 count = 0;
+		for (uint64 word : Words)
+		{
+			count += PopCount(word);
+		}
+		return count;
+	}
+
+	// Returns the number of positive pixels with an index in [first, end)
+	int32 CountPositive(int32 first, int32 end) const
+	{
+		if (end <= first)
+		{
+			return 0;
+		}
+		int32 firstWord = first >> 6, lastWord = (end - 1) >> 6;
+		uint64 firstMask = ~(uint64)0 << (first & 63);
+		uint64 lastMask = ~(uint64)0 >> (63 - ((end - 1) & 63));
+		if (firstWord == lastWord)
+		{
+			return PopCount(Words[firstWord] & firstMask & lastMask);
+		}
+		int32 count = PopCount(Words[firstWord] & firstMask) + PopCount(Words[lastWord] & lastMask);
+		for (int32 w = firstWord + 1; w < lastWord; w++)
+		{
+			count += PopCount(Words[w]);
+		}
+		return count;
+	}
+
+	// Returns the number of positive pixels in the given region, clipped to the image
+	int32 CountPositive(const FIntRect& region) const
+	{
+		int32 minX = FMath::Max(region.Min.X, 0), maxX = FMath::Min(region.Max.X, Width);
+		int32 minY = FMath::Max(region.Min.Y, 0), maxY = FMath::Min(region.Max.Y, Height);
+		int32 count = 0;
+		for (int32 y = minY; y < maxY; y++)
+		{
+			count += CountPositive(y * Width + minX, y * Width + maxX);
+		}
+		return count;
+	}
+
+	// Returns the number of bits set
+	static FORCEINLINE int32 PopCount(uint64 bits)
+	{
+		bits = bits - ((bits >> 1) & 0x5555555555555555ull);
+		bits = (bits & 0x3333333333333333ull) + ((bits >> 2) & 0x3333333333333333ull);
+		bits = (bits + (bits >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+		return (int32)((bits * 0x0101010101010101ull) >> 56);
+	}
+
+	// Returns the index of the lowest bit set
+	// PRE: bits != 0
+	static FORCEINLINE int32 LowestBit(uint64 bits)
+	{
+		uint32 low = (uint32)bits;
+		return low != 0 ? FMath::CountTrailingZeros(low) : 32 + FMath::CountTrailingZeros((uint32)(bits >> 32));
+	}
+
+	bool operator==(const FVisionMask& other) const
+	{
+		return Width == other.Width && Height == other.Height && Words == other.Words;
+	}
+};
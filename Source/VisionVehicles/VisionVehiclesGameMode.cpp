@@ -4,9 +4,163 @@
 #include "VisionVehiclesGameMode.h"
 #include "VisionVehiclesPawn.h"
 #include "VisionVehiclesHud.h"
+#include "GameFramework/PlayerStart.h"
+#include "WheeledVehicleMovementComponent.h"
 
 AVisionVehiclesGameMode::AVisionVehiclesGameMode()
 {
 	DefaultPawnClass = AVisionVehiclesPawn::StaticClass();
 	HUDClass = AVisionVehiclesHud::StaticClass();
+
+	// Set training defaults
+	bHeadlessTraining = false;
+	FixedTimeStep = 1.0f / 60.0f;
+	NumTrainingVehicles = 8;
+	TrainingVehicleSpacing = 500.0f;
+	MetricsFile = TEXT("TrainingMetrics.csv");
+	MetricsInterval = 10.0f;
+	SimulationDuration = 0.0f;
+
+	PrimaryActorTick.bCanEverTick = true;
+	simulatedTime = 0.0;
+	simulatedFrames = 0;
+	vehicleTime = 0.0;
+	startTime = 0.0;
+	nextMetricsTime = 0.0;
+}
+
+void AVisionVehiclesGameMode::StartPlay()
+{
+	// The command line overrides the settings
+	const TCHAR* commandLine = FCommandLine::Get();
+	bHeadlessTraining |= FParse::Param(commandLine, TEXT("VVHeadless"));
+	FParse::Value(commandLine, TEXT("VVTimeStep="), FixedTimeStep);
+	FParse::Value(commandLine, TEXT("VVVehicles="), NumTrainingVehicles);
+	FParse::Value(commandLine, TEXT("VVDuration="), SimulationDuration);
+
+	Super::StartPlay();
+
+	if (!bHeadlessTraining)
+	{
+		return;
+	}
+
+	// Step every frame by the same simulated time, without waiting for the wall clock
+	FixedTimeStep = FMath::Max(FixedTimeStep, 0.001f);
+	FApp::SetBenchmarking(true);
+	FApp::SetFixedDeltaTime(FixedTimeStep);
+
+	SpawnTrainingVehicles();
+
+	FString fileName = FPaths::Combine(FPaths::GameSavedDir(), MetricsFile);
+	metricsWriter = TUniquePtr<FArchive>(IFileManager::Get().CreateFileWriter(*fileName));
+	if (metricsWriter.IsValid())
+	{
+		FString header = TEXT("SimulatedTime,WallTime,SimulatedSecondsPerSecond,Frames,Vehicles,VehicleHours,MeanSpeed,MeanTrackCoverage,OffTrackVehicles,TrainingSamplesPerSecond\n");
+		metricsWriter->Serialize(TCHAR_TO_ANSI(*header), header.Len());
+	}
+	else
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Could not create the training metrics file %s."), *fileName);
+	}
+
+	startTime = FPlatformTime::Seconds();
+	nextMetricsTime = MetricsInterval;
+	UE_LOG(LogTemp, Display, TEXT("Headless training started with %d vehicles, a fixed timestep of %.4f s%s."),
+		NumTrainingVehicles, FixedTimeStep, GUsingNullRHI ? TEXT(" and no renderer") : TEXT(""));
+}
+
+void AVisionVehiclesGameMode::Tick(float DeltaSeconds)
+{
+	Super::Tick(DeltaSeconds);
+
+	if (!bHeadlessTraining)
+	{
+		return;
+	}
+
+	int32 numVehicles = 0;
+	for (TActorIterator<AVisionVehiclesPawn> vehicle(GetWorld()); vehicle; ++vehicle)
+	{
+		++numVehicles;
+	}
+	simulatedTime += DeltaSeconds;
+	vehicleTime += DeltaSeconds * numVehicles;
+	++simulatedFrames;
+
+	if (simulatedTime >= nextMetricsTime)
+	{
+		WriteMetrics();
+		nextMetricsTime += FMath::Max(MetricsInterval, 0.1f);
+	}
+	if (SimulationDuration > 0.0f && simulatedTime >= SimulationDuration)
+	{
+		UE_LOG(LogTemp, Display, TEXT("Headless training simulated %.1f s in %.1f s, exiting."), simulatedTime, FPlatformTime::Seconds() - startTime);
+		FPlatformMisc::RequestExit(false);
+		SimulationDuration = 0.0f;
+	}
+}
+
+void AVisionVehiclesGameMode::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (metricsWriter.IsValid())
+	{
+		WriteMetrics();
+		metricsWriter->Close();
+		metricsWriter.Reset();
+	}
+
+	Super::EndPlay(EndPlayReason);
+}
+
+bool AVisionVehiclesGameMode::IsHeadlessTraining() const
+{
+	return bHeadlessTraining;
+}
+
+void AVisionVehiclesGameMode::SpawnTrainingVehicles()
+{
+	// Place the vehicles in rows of 4 behind the player start
+	TActorIterator<APlayerStart> playerStart(GetWorld());
+	FTransform startTransform = playerStart ? playerStart->GetActorTransform() : FTransform::Identity;
+	FActorSpawnParameters spawnParameters;
+	spawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn;
+	for (int32 i = 0; i < NumTrainingVehicles; i++)
+	{
+		int32 row = i / 4 + 1, column = i % 4;
+		FVector offset(-row * TrainingVehicleSpacing, (column - 1.5f) * TrainingVehicleSpacing, 0.0f);
+		FTransform transform(startTransform.GetRotation(), startTransform.TransformPosition(offset));
+		APawn* vehicle = GetWorld()->SpawnActor<APawn>(DefaultPawnClass, transform, spawnParameters);
+		if (vehicle != nullptr && vehicle->Controller == nullptr)
+		{
+			vehicle->SpawnDefaultController();
+		}
+	}
+}
+
+void AVisionVehiclesGameMode::WriteMetrics()
+{
+	int32 numVehicles = 0, numOffTrack = 0;
+	float totalSpeed = 0.0f, totalCoverage = 0.0f;
+	AVisionVehiclesPawn* firstVehicle = nullptr;
+	for (TActorIterator<AVisionVehiclesPawn> vehicle(GetWorld()); vehicle; ++vehicle)
+	{
+		++numVehicles;
+		totalSpeed += FMath::Abs(vehicle->GetVehicleMovement()->GetForwardSpeed()) * 0.036f;
+		float coverage = vehicle->GetTrackFeatures().Coverage;
+		totalCoverage += coverage;
+		numOffTrack += coverage == 0.0f;
+		firstVehicle = firstVehicle != nullptr ? firstVehicle : *vehicle;
+	}
+
+	double wallTime = FPlatformTime::Seconds() - startTime;
+	FString row = FString::Printf(TEXT("%.3f,%.3f,%.2f,%lld,%d,%.4f,%.2f,%.4f,%d,%.1f\n"),
+		simulatedTime, wallTime, wallTime > 0.0 ? simulatedTime / wallTime : 0.0, simulatedFrames, numVehicles, vehicleTime / 3600.0,
+		numVehicles > 0 ? totalSpeed / numVehicles : 0.0f, numVehicles > 0 ? totalCoverage / numVehicles : 0.0f, numOffTrack,
+		firstVehicle != nullptr ? firstVehicle->GetTrainingSamplesPerSecond() : 0.0f);
+	if (metricsWriter.IsValid())
+	{
+		metricsWriter->Serialize(TCHAR_TO_ANSI(*row), row.Len());
+		metricsWriter->Flush();
+	}
 }
@@ -3,14 +3,72 @@
 #include "GameFramework/GameModeBase.h"
 #include "VisionVehiclesGameMode.generated.h"
 
-UCLASS(minimalapi)
+class AVisionVehiclesPawn;
+
+UCLASS(minimalapi, config = Game)
 class AVisionVehiclesGameMode : public AGameModeBase
 {
 	GENERATED_BODY()
 
+	/* Whether to run the headless training simulation: the world is stepped at a fixed timestep as fast as the CPU allows,
+	 * with several vehicles driving at once, and training metrics are written to a CSV file.
+	 * It is also enabled with -VVHeadless on the command line, and is meant to be run with -nullrhi on machines without a GPU.*/
+	UPROPERTY(Category = Training, EditAnywhere, BlueprintReadOnly, Config, meta = (AllowPrivateAccess = "true"))
+	bool bHeadlessTraining;
+
+	/* The simulated time of each frame in the headless simulation, in seconds. It can be set with -VVTimeStep=.*/
+	UPROPERTY(Category = Training, EditAnywhere, BlueprintReadOnly, Config, meta = (AllowPrivateAccess = "true", ClampMin = "0.001", UIMin = "0.005", UIMax = "0.1"))
+	float FixedTimeStep;
+
+	/* The number of vehicles spawned in the headless simulation, besides the player's. It can be set with -VVVehicles=.*/
+	UPROPERTY(Category = Training, EditAnywhere, BlueprintReadOnly, Config, meta = (AllowPrivateAccess = "true", ClampMin = "0", UIMin = "0", UIMax = "64"))
+	int32 NumTrainingVehicles;
+
+	/* The distance between the vehicles spawned around the player start, in centimeters.*/
+	UPROPERTY(Category = Training, EditAnywhere, BlueprintReadOnly, Config, meta = (AllowPrivateAccess = "true"))
+	float TrainingVehicleSpacing;
+
+	/* The CSV file the training metrics are written to, relative to the Saved directory.*/
+	UPROPERTY(Category = Training, EditAnywhere, BlueprintReadOnly, Config, meta = (AllowPrivateAccess = "true"))
+	FString MetricsFile;
+
+	/* The simulated time between two rows of training metrics, in seconds.*/
+	UPROPERTY(Category = Training, EditAnywhere, BlueprintReadOnly, Config, meta = (AllowPrivateAccess = "true", ClampMin = "0.1"))
+	float MetricsInterval;
+
+	/* The simulated time after which the game exits, in seconds, or 0 to run until it is closed. It can be set with -VVDuration=.*/
+	UPROPERTY(Category = Training, EditAnywhere, BlueprintReadOnly, Config, meta = (AllowPrivateAccess = "true", ClampMin = "0"))
+	float SimulationDuration;
+
 public:
 	AVisionVehiclesGameMode();
-};
 
+	// Begin AActor interface
+	virtual void StartPlay() override;
+	virtual void Tick(float DeltaSeconds) override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+	// End AActor interface
+
+	/* Returns whether the headless training simulation is running */
+	UFUNCTION(BlueprintCallable, Category = Training)
+	bool IsHeadlessTraining() const;
+
+private:
+	/* The file the training metrics are written to */
+	TUniquePtr<FArchive> metricsWriter;
 
+	/* The simulated time, the number of simulated frames and the vehicle time driven since the simulation started */
+	double simulatedTime;
+	int64 simulatedFrames;
+	double vehicleTime;
 
+	/* The wall clock time the simulation started at, and the simulated time of the next row of metrics */
+	double startTime;
+	double nextMetricsTime;
+
+	/* Spawns the training vehicles around the player start, each possessed by its AI controller */
+	void SpawnTrainingVehicles();
+
+	/* Writes a row of training metrics */
+	void WriteMetrics();
+};
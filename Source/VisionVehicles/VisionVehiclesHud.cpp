@@ -18,62 +18,21 @@
 #include "IHeadMountedDisplay.h"
 #endif // HMD_MODULE_INCLUDED 
 
-// Function for enqueueing tasks on the render thread.
-// This is taken from: https://wiki.unrealengine.com/Dynamic_Textures and https://wiki.unrealengine.com/Procedural_Materials
-void UpdateTextureRegions(UTexture2D* Texture, int32 MipIndex, uint32 NumRegions, FUpdateTextureRegion2D* Regions, uint32 SrcPitch, uint32 SrcBpp, uint8* SrcData, bool bFreeData)
+// Uploads the rows staged in a buffer to the texture on the rendering thread, and gives the buffer back to the game thread
+static void UploadStagedRows(UTexture2D* texture, FVisionUploadBuffer* buffer)
 {
-	if (Texture->Resource)
-	{
-		struct FUpdateTextureRegionsData
+	FTexture2DResource* resource = (FTexture2DResource*)texture->Resource;
+	ENQUEUE_UNIQUE_RENDER_COMMAND_TWOPARAMETER(
+		UploadVisionRows,
+		FTexture2DResource*, resource, resource,
+		FVisionUploadBuffer*, buffer, buffer,
 		{
-			FTexture2DResource* Texture2DResource;
-			int32 MipIndex;
-			uint32 NumRegions;
-			FUpdateTextureRegion2D* Regions;
-			uint32 SrcPitch;
-			uint32 SrcBpp;
-			uint8* SrcData;
-		};
-
-		FUpdateTextureRegionsData* RegionData = new FUpdateTextureRegionsData;
-
-		RegionData->Texture2DResource = (FTexture2DResource*)Texture->Resource;
-		RegionData->MipIndex = MipIndex;
-		RegionData->NumRegions = NumRegions;
-		RegionData->Regions = Regions;
-		RegionData->SrcPitch = SrcPitch;
-		RegionData->SrcBpp = SrcBpp;
-		RegionData->SrcData = SrcData;
-
-		ENQUEUE_UNIQUE_RENDER_COMMAND_TWOPARAMETER(
-			UpdateTextureRegionsData,
-			FUpdateTextureRegionsData*, RegionData, RegionData,
-			bool, bFreeData, bFreeData,
+			if (resource != nullptr)
 			{
-				for (uint32 RegionIndex = 0; RegionIndex < RegionData->NumRegions; ++RegionIndex)
-				{
-					int32 CurrentFirstMip = RegionData->Texture2DResource->GetCurrentFirstMip();
-					if (RegionData->MipIndex >= CurrentFirstMip)
-					{
-						RHIUpdateTexture2D(
-							RegionData->Texture2DResource->GetTexture2DRHI(),
-							RegionData->MipIndex - CurrentFirstMip,
-							RegionData->Regions[RegionIndex],
-							RegionData->SrcPitch,
-							RegionData->SrcData
-							+ RegionData->Regions[RegionIndex].SrcY * RegionData->SrcPitch
-							+ RegionData->Regions[RegionIndex].SrcX * RegionData->SrcBpp
-						);
-					}
-				}
-		if (bFreeData)
-		{
-			FMemory::Free(RegionData->Regions);
-			FMemory::Free(RegionData->SrcData);
-		}
-		delete RegionData;
-			});
-	}
+				RHIUpdateTexture2D(resource->GetTexture2DRHI(), 0, buffer->region, buffer->region.Width, buffer->rows.GetData());
+			}
+			buffer->bInFlight = false;
+		});
 }
 
 
@@ -84,11 +43,32 @@ AVisionVehiclesHud::AVisionVehiclesHud()
 	// Set defaults
 	VisionQuadPosition = FVector2D(0.0f, 0.0f);
 	VisionQuadScale = FVector2D(200.0f, 200.0f);
+	dynamicVisionMaterial = nullptr;
+	dynamicVisionTexture = nullptr;
+	visionTextureWidth = visionTextureHeight = 0;
+	visionTextureSource = nullptr;
+	visionTextureClass = INDEX_NONE;
+	visionTextureVersion = 0;
+	pendingFirstRow = pendingEndRow = 0;
+	nextUploadBuffer = 0;
 
 	static ConstructorHelpers::FObjectFinder<UFont> Font(TEXT("/Engine/EngineFonts/RobotoDistanceField"));
 	HUDFont = Font.Object;
 }
 
+void AVisionVehiclesHud::BeginDestroy()
+{
+	Super::BeginDestroy();
+
+	// The upload buffers can't be freed until the rendering thread is done with them
+	uploadFence.BeginFence();
+}
+
+bool AVisionVehiclesHud::IsReadyForFinishDestroy()
+{
+	return Super::IsReadyForFinishDestroy() && uploadFence.IsFenceComplete();
+}
+
 void AVisionVehiclesHud::BeginPlay()
 {
 	if (VisionMaterial != nullptr)
@@ -98,37 +78,72 @@ void AVisionVehiclesHud::BeginPlay()
 		UVehicleVisionComponent* visionComponent = nullptr;
 		if ((vehicle != nullptr) && ((visionComponent = vehicle->GetVisionComponent()) != nullptr))
 		{
-			TBitArray<> visionFeed = visionComponent->GetFeed();
-			int32 textureSize = FMath::Sqrt(visionFeed.Num());
+			const FVisionMask& visionFeed = visionComponent->GetClassFeed(FMath::Max(visionComponent->FindClass(VisionClass), 0));
 
 			// Create the dynamic vision material
 			dynamicVisionMaterial = UMaterialInstanceDynamic::Create(VisionMaterial, vehicle);
 
-			// Create a dynamic texture with the default compression (B8G8R8A8)
-			dynamicVisionTexture = UTexture2D::CreateTransient(textureSize, textureSize);
-			dynamicVisionTexture->CompressionSettings = TextureCompressionSettings::TC_VectorDisplacementmap; //Make sure it won't be compressed
-			dynamicVisionTexture->SRGB = 0; //Turn off Gamma-correction
-			dynamicVisionTexture->AddToRoot(); //Guarantee no garbage collection by adding it as a root reference
-			dynamicVisionTexture->UpdateResource(); //Update the texture with new variable values.
+			CreateVisionTexture(visionFeed.Width, visionFeed.Height);
+		}
+	}
+}
 
-			// Initalize our dynamic pixel array with data size
-			dynamicVisionColors = new uint8[textureSize * textureSize * 4]; // * 4 because each color is made out of 4 uint8
-			for (int i = 0; i < textureSize * textureSize; i++)
-			{
-				dynamicVisionColors[i * 4 + 0] = 0;
-				dynamicVisionColors[i * 4 + 1] = 0;
-				dynamicVisionColors[i * 4 + 2] = 0;
-				dynamicVisionColors[i * 4 + 3] = 255;
-			}
+void AVisionVehiclesHud::CreateVisionTexture(int32 width, int32 height)
+{
+	if (dynamicVisionTexture != nullptr)
+	{
+		// The pending uploads to the previous texture use their own buffers, so they don't need to be waited for
+		dynamicVisionTexture->RemoveFromRoot();
+		dynamicVisionTexture = nullptr;
+	}
+	visionTextureWidth = width;
+	visionTextureHeight = height;
+	dynamicVisionColors.Reset();
+	pendingFirstRow = pendingEndRow = 0;
+	if (width <= 0 || height <= 0)
+	{
+		return;
+	}
 
-			// Create a new texture region with the width and height of our dynamic texture
-			updateTextureRegion = new FUpdateTextureRegion2D(0, 0, 0, 0, textureSize, textureSize);
+	// Create a dynamic texture with one byte per pixel (G8), which the vision material reads from the red channel
+	dynamicVisionTexture = UTexture2D::CreateTransient(width, height, PF_G8);
+	dynamicVisionTexture->CompressionSettings = TextureCompressionSettings::TC_Grayscale; //Make sure it won't be compressed
+	dynamicVisionTexture->SRGB = 0; //Turn off Gamma-correction
+	dynamicVisionTexture->AddToRoot(); //Guarantee no garbage collection by adding it as a root reference
+	dynamicVisionTexture->UpdateResource(); //Update the texture with new variable values.
 
-			// Update texture and assign it to material
-			UpdateTextureRegions(dynamicVisionTexture, 0, 1, updateTextureRegion, (uint32)(textureSize * 4), (uint32)4, dynamicVisionColors, false);
-			dynamicVisionMaterial->SetTextureParameterValue("DynamicTextureParam", dynamicVisionTexture);
-		}
+	// Initalize our dynamic pixel array with data size, all black
+	dynamicVisionColors.SetNumZeroed(width * height);
+
+	// Update texture and assign it to material
+	pendingFirstRow = 0;
+	pendingEndRow = height;
+	UploadPendingRows();
+	dynamicVisionMaterial->SetTextureParameterValue("DynamicTextureParam", dynamicVisionTexture);
+}
+
+void AVisionVehiclesHud::UploadPendingRows()
+{
+	if (pendingEndRow <= pendingFirstRow)
+	{
+		return;
+	}
+
+	// Stage the rows in a buffer the rendering thread isn't using. If they are all in flight, try again next frame rather than wait.
+	FVisionUploadBuffer* buffer = &uploadBuffers[nextUploadBuffer];
+	if (buffer->bInFlight)
+	{
+		return;
 	}
+	nextUploadBuffer = (nextUploadBuffer + 1) % NumUploadBuffers;
+
+	int32 numRows = pendingEndRow - pendingFirstRow;
+	buffer->rows.SetNumUninitialized(numRows * visionTextureWidth, false);
+	FMemory::Memcpy(buffer->rows.GetData(), &dynamicVisionColors[pendingFirstRow * visionTextureWidth], numRows * visionTextureWidth);
+	buffer->region = FUpdateTextureRegion2D(0, pendingFirstRow, 0, 0, visionTextureWidth, numRows);
+	buffer->bInFlight = true;
+	UploadStagedRows(dynamicVisionTexture, buffer);
+	pendingFirstRow = pendingEndRow = 0;
 }
 
 void AVisionVehiclesHud::DrawHUD()
@@ -174,28 +189,69 @@ void AVisionVehiclesHud::DrawHUD()
 
 void AVisionVehiclesHud::UpdateVisionTexture()
 {
+	// There is nothing to draw the feed with without a vision material
+	if (dynamicVisionMaterial == nullptr)
+	{
+		return;
+	}
+
 	// Get our vehicle so we can initialize the dynamic texture from the vision feed
 	AVisionVehiclesPawn* vehicle = Cast<AVisionVehiclesPawn>(GetOwningPawn());
 	UVehicleVisionComponent* visionComponent = nullptr;
 	if ((vehicle != nullptr) && ((visionComponent = vehicle->GetVisionComponent()) != nullptr))
 	{
-		TBitArray<> visionFeed = visionComponent->GetFeed();
-		int32 textureSize = FMath::Sqrt(visionFeed.Num());
+		int32 visionClass = FMath::Max(visionComponent->FindClass(VisionClass), 0);
+		const FVisionMask& visionFeed = visionComponent->GetClassFeed(visionClass);
+
+		// Recreate the texture if the size of the feed changed, for example with a new region of interest
+		if (visionFeed.Width != visionTextureWidth || visionFeed.Height != visionTextureHeight)
+		{
+			CreateVisionTexture(visionFeed.Width, visionFeed.Height);
+		}
+		if (dynamicVisionTexture == nullptr)
+		{
+			return;
+		}
+
+		// The texture is up to date if the feed hasn't been classified again since it was built, but rows may be left to upload
+		uint32 feedVersion = visionComponent->GetFeedVersion();
+		if (visionComponent == visionTextureSource && visionClass == visionTextureClass && feedVersion == visionTextureVersion)
+		{
+			UploadPendingRows();
+			return;
+		}
+		visionTextureSource = visionComponent;
+		visionTextureClass = visionClass;
+		visionTextureVersion = feedVersion;
 
-		// Build the vision HUD texture
-		for (int i = 0; i < visionFeed.Num(); ++i)
+		// Build the vision HUD texture, and find the rows that changed
+		int32 firstDirtyRow = visionTextureHeight, lastDirtyRow = -1;
+		for (int32 y = 0; y < visionTextureHeight; y++)
 		{
-			// Set pixel to white if positive, black otherwise
-			bool value = visionFeed[i];
-			dynamicVisionColors[i * 4 + 0] = value * 255;
-			dynamicVisionColors[i * 4 + 1] = value * 255;
-			dynamicVisionColors[i * 4 + 2] = value * 255;
-			dynamicVisionColors[i * 4 + 3] = 255;
+			uint8* row = &dynamicVisionColors[y * visionTextureWidth];
+			bool bRowChanged = false;
+			for (int32 x = 0; x < visionTextureWidth; x++)
+			{
+				// Set pixel to white if positive, black otherwise
+				uint8 value = visionFeed[y * visionTextureWidth + x] ? 255 : 0;
+				bRowChanged |= row[x] != value;
+				row[x] = value;
+			}
+			if (bRowChanged)
+			{
+				firstDirtyRow = FMath::Min(firstDirtyRow, y);
+				lastDirtyRow = y;
+			}
 		}
 
-		// Update texture and assign it to material
-		UpdateTextureRegions(dynamicVisionTexture, 0, 1, updateTextureRegion, (uint32)(textureSize * 4), (uint32)4, dynamicVisionColors, false);
-		dynamicVisionMaterial->SetTextureParameterValue("DynamicTextureParam", dynamicVisionTexture);
+		// Only upload the rows that changed, along with the ones that couldn't be uploaded yet
+		if (lastDirtyRow >= firstDirtyRow)
+		{
+			bool bHasPendingRows = pendingEndRow > pendingFirstRow;
+			pendingFirstRow = bHasPendingRows ? FMath::Min(pendingFirstRow, firstDirtyRow) : firstDirtyRow;
+			pendingEndRow = bHasPendingRows ? FMath::Max(pendingEndRow, lastDirtyRow + 1) : lastDirtyRow + 1;
+		}
+		UploadPendingRows();
 	}
 }
 
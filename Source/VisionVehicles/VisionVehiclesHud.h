@@ -3,6 +3,23 @@
 #include "GameFramework/HUD.h"
 #include "VisionVehiclesHud.generated.h"
 
+class UVehicleVisionComponent;
+
+/* A buffer rows of the HUD vision texture are staged in to be uploaded.
+ *	The rendering thread owns it from when the upload is enqueued until it clears bInFlight, so the game thread never writes
+ *	to a buffer that is being uploaded, and never waits for one. */
+struct FVisionUploadBuffer
+{
+	// The staged rows, one byte per pixel
+	TArray<uint8> rows;
+
+	// The rows of the texture they are uploaded to
+	FUpdateTextureRegion2D region;
+
+	// Whether the upload has been enqueued and hasn't been done yet
+	FThreadSafeBool bInFlight;
+};
+
 
 UCLASS(config = Game)
 class AVisionVehiclesHud : public AHUD
@@ -13,7 +30,8 @@ class AVisionVehiclesHud : public AHUD
 	UPROPERTY()
 	UFont* HUDFont;
 
-	/* Material used to render the vehicle vision info */
+	/* Material used to render the vehicle vision info.
+	 * The feed is in the red channel of its DynamicTextureParam texture, which has one byte per pixel */
 	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
 	UMaterialInterface* VisionMaterial;
 
@@ -25,6 +43,10 @@ class AVisionVehiclesHud : public AHUD
 	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
 	FVector2D VisionQuadScale;
 
+	/* The label of the vision class shown. If it is none or not found, the first class is shown */
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
+	FName VisionClass;
+
 public:
 	AVisionVehiclesHud();
 
@@ -32,6 +54,11 @@ public:
 	virtual void DrawHUD() override;
 	// End AHUD interface
 
+	// Begin UObject interface
+	virtual void BeginDestroy() override;
+	virtual bool IsReadyForFinishDestroy() override;
+	// End UObject interface
+
 	// Begin AActor interface
 	virtual void BeginPlay() override;
 	// End AActor interface
@@ -44,11 +71,39 @@ private:
 	/* The dynamic texture used by the dynamic vision material */
 	UTexture2D* dynamicVisionTexture;
 
-	/* The colors array used by the dynamic vision texture */
-	uint8* dynamicVisionColors;
+	/* The pixels last uploaded to the dynamic vision texture, one byte per pixel */
+	TArray<uint8> dynamicVisionColors;
+
+	/* The size of the dynamic vision texture, which is the size of the vision feed */
+	int32 visionTextureWidth;
+	int32 visionTextureHeight;
+
+	/* The vision component, class and feed version the dynamic vision texture was last built from */
+	const UVehicleVisionComponent* visionTextureSource;
+	int32 visionTextureClass;
+	uint32 visionTextureVersion;
+
+	/* Creates the dynamic vision texture for a feed of the given size, replacing the previous one */
+	void CreateVisionTexture(int32 width, int32 height);
+
+	/* The number of uploads of the dynamic vision texture that can be in flight at once */
+	static const int32 NumUploadBuffers = 3;
+
+	/* The ring of buffers the rows of the dynamic vision texture are uploaded from. Each HUD has its own, so each viewport can have its overlay */
+	FVisionUploadBuffer uploadBuffers[NumUploadBuffers];
+
+	/* The next upload buffer of the ring to use. The buffers are used in order, so the oldest upload is the one waited for */
+	int32 nextUploadBuffer;
+
+	/* The range of rows of the dynamic vision texture that changed and haven't been uploaded yet */
+	int32 pendingFirstRow;
+	int32 pendingEndRow;
+
+	/* The fence signaled when the rendering thread is done with the upload buffers */
+	FRenderCommandFence uploadFence;
 
-	/* The update region of the dynamic vision texture. Needed for the UpdateTextureRegions function */
-	FUpdateTextureRegion2D* updateTextureRegion;
+	/* Uploads the pending rows of the dynamic vision texture, if there is a free upload buffer */
+	void UploadPendingRows();
 
 	/* Updates the texture used to render the vehicle vision info */
 	void UpdateVisionTexture();
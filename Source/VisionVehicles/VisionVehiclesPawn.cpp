@@ -13,6 +13,7 @@
 #include "Engine/SkeletalMesh.h"
 #include "Engine.h"
 #include "VehicleVisionComponent.h"
+#include "VisionFeatures.h"
 #include "NeuralNetwork.h"
 
 // Needed for VR Headset
@@ -126,6 +127,26 @@ AVisionVehiclesPawn::AVisionVehiclesPawn()
 	NumberOfOutputs = 1;
 	InitialLearningRate = 0.1f;
 	LearningRateDecay = 0.001f;
+
+	// Set experience replay defaults
+	bUseExperienceReplay = false;
+	ReplayCapacity = 16384;
+	ReplaySampling = EExperienceSampling::Shuffled;
+	ReplayBatchSize = 32;
+	ReplayBatchesPerRound = 4;
+	experienceReplayVersion = 0;
+
+	// Set recording defaults
+	bRecordDrive = false;
+	bRecordMasks = false;
+	RecordingDirectory = TEXT("Recordings");
+	RecordingSlots = 1024;
+	lastThrottle = 0.0f;
+	lastSteering = 0.0f;
+	pendingReward = 0.0f;
+
+	trackFeaturesVersion = 0;
+	trackFeaturesClass = INDEX_NONE;
 }
 
 void AVisionVehiclesPawn::SetupPlayerInputComponent(class UInputComponent* PlayerInputComponent)
@@ -150,11 +171,13 @@ void AVisionVehiclesPawn::SetupPlayerInputComponent(class UInputComponent* Playe
 void AVisionVehiclesPawn::MoveForward(float Val)
 {
 	GetVehicleMovementComponent()->SetThrottleInput(Val);
+	lastThrottle = Val;
 }
 
 void AVisionVehiclesPawn::MoveRight(float Val)
 {
 	GetVehicleMovementComponent()->SetSteeringInput(Val);
+	lastSteering = Val;
 }
 
 void AVisionVehiclesPawn::OnHandbrakePressed()
@@ -226,6 +249,17 @@ void AVisionVehiclesPawn::Tick(float Delta)
 			InternalCamera->RelativeRotation = HeadRotation;
 		}
 	}
+
+	if (experienceReplay.IsValid())
+	{
+		experienceReplay->Update();
+		experienceReplay->PullWeights(NeuralNetwork, experienceReplayVersion);
+	}
+
+	if (bRecordDrive)
+	{
+		RecordTick();
+	}
 }
 
 void AVisionVehiclesPawn::BeginPlay()
@@ -241,8 +275,37 @@ void AVisionVehiclesPawn::BeginPlay()
      // Set neural network
      NeuralNetwork = UNeuralNetwork::GetInstance();
 
-	// Initialize neural network
-	NeuralNetwork->Init(NumberOfInputs, NumberOfOutputs, HiddenLayers, InitialLearningRate, LearningRateDecay);
+	// Load the trained neural network, or initialize a new one
+	if (NeuralNetworkFile.IsEmpty() || !NeuralNetwork->LoadFromFile(NeuralNetworkFile))
+	{
+		NeuralNetwork->Init(NumberOfInputs, NumberOfOutputs, HiddenLayers, InitialLearningRate, LearningRateDecay);
+	}
+
+	if (bUseExperienceReplay)
+	{
+		FExperienceReplay::FSettings settings;
+		settings.Capacity = ReplayCapacity;
+		settings.Sampling = ReplaySampling;
+		settings.BatchSize = ReplayBatchSize;
+		settings.BatchesPerRound = ReplayBatchesPerRound;
+		experienceReplay = FExperienceReplay::Create(ReplayGroup, NeuralNetwork, settings);
+		experienceReplayVersion = 0;
+	}
+
+	bRecordDrive |= FParse::Param(FCommandLine::Get(), TEXT("VVRecord"));
+}
+
+void AVisionVehiclesPawn::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (recorder.IsValid())
+	{
+		recorder->Close();
+		UE_LOG(LogTemp, Log, TEXT("%s recorded %d ticks, %d were dropped."), *GetName(), recorder->GetNumRecorded(), recorder->GetNumDropped());
+		recorder.Reset();
+	}
+	experienceReplay.Reset();
+
+	Super::EndPlay(EndPlayReason);
 }
 
 void AVisionVehiclesPawn::OnResetVR()
@@ -299,7 +362,7 @@ void AVisionVehiclesPawn::SetupInCarHUD()
 bool checked_value = false;
 
 
-FVector2D AVisionVehiclesPawn::FindTrackEnd(TArray<bool> cameraFeed)
+FVector2D AVisionVehiclesPawn::FindTrackEnd(const TArray<bool>& cameraFeed, int32 width)
 {
      //if (cameraFeed.Num() != size_y*size_x)
      //     return FVector2D(-1, -1);
@@ -327,10 +390,12 @@ FVector2D AVisionVehiclesPawn::FindTrackEnd(TArray<bool> cameraFeed)
      //if (!end_point_found)
      //{
 
-     int size = sqrt(cameraFeed.Num()),
+     int size = width > 0 ? width : sqrt(cameraFeed.Num()),
           half_size = size / 2,
           left = 0,
           right = 0;
+     if (half_size == 0)
+          return FVector2D(0, 0);
      for (int i = 0; i < cameraFeed.Num(); i++)
      {
           if (cameraFeed[i] == checked_value)
@@ -386,61 +451,157 @@ FVector2D AVisionVehiclesPawn::FindTrackEnd(TArray<bool> cameraFeed)
      //return FVector2D(-1, -1);
 }
 
-TArray<float> AVisionVehiclesPawn::ProcessCameraFeed()
+FVector2D AVisionVehiclesPawn::FindTrackEnd(const FVisionMask& cameraFeed)
 {
-	TBitArray<> feed = GetVisionComponent()->GetFeed();
+	int32 halfSize = cameraFeed.Width / 2, left = 0, right = 0;
+	if (halfSize == 0)
+	{
+		return FVector2D(0, 0);
+	}
 
-	// Compute the vertical projection histogram of the image
-	TArray<float> verticalProjectionHistogram;
-	int n = FMath::Sqrt(feed.Num());
-	int totalCount = 0;
-	for (int j = 0; j < n; j++)
+	// Visit the pixels equal to checked_value only, word by word
+	int32 numPixels = cameraFeed.Num();
+	for (int32 w = 0; w < cameraFeed.Words.Num(); w++)
 	{
-		int columnCount = 0;
-		for (int i = 0; i < n; i++)
+		uint64 word = checked_value ? cameraFeed.Words[w] : ~cameraFeed.Words[w];
+		if (numPixels - w * 64 < 64)
+		{
+			word &= ((uint64)1 << (numPixels - w * 64)) - 1;
+		}
+		while (word != 0)
 		{
-			if (feed[i * n + j])
+			int32 i = w * 64 + FVisionMask::LowestBit(word);
+			if (i % halfSize % 2 == 0)
 			{
-				++columnCount;
-				++totalCount;
+				left++;
 			}
+			else
+			{
+				right++;
+			}
+			word &= word - 1;
 		}
-		verticalProjectionHistogram.Add(columnCount);
 	}
-	for (int i = 0; i < n; i++)
+	return FVector2D(left, right);
+}
+
+TArray<float> AVisionVehiclesPawn::ProcessCameraFeed()
+{
+	TArray<float> inputs;
+	inputs.SetNumUninitialized(NumFeedInputs);
+	ProcessCameraFeed(inputs);
+	return inputs;
+}
+
+bool AVisionVehiclesPawn::ProcessCameraFeed(TArrayView<float> inputs)
+{
+	if (inputs.Num() != NumFeedInputs)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Trying to process the camera feed into %d inputs instead of %d."), inputs.Num(), NumFeedInputs);
+		return false;
+	}
+
+	int32 trackClass = FMath::Max(GetVisionComponent()->FindClass(TrackVisionClass), 0);
+	const FVisionMask& feed = GetVisionComponent()->GetClassFeed(trackClass);
+
+	// Compute the inputs from the vertical projection histogram, unless the feed hasn't changed since they were computed
+	uint32 feedVersion = GetVisionComponent()->GetFeedVersion();
+	if (trackFeaturesVersion != feedVersion || trackFeaturesClass != trackClass)
+	{
+		trackFeatures = FVisionFeatures::Compute(feed);
+		trackFeaturesVersion = feedVersion;
+		trackFeaturesClass = trackClass;
+	}
+
+	inputs[0] = trackFeatures.Coverage;
+	inputs[1] = trackFeatures.Mean;
+	inputs[2] = trackFeatures.StandardDeviation;
+	inputs[3] = trackFeatures.Skewness;
+	inputs[4] = GetVehicleMovement()->GetForwardSpeed() / 2500.0f;
+	return true;
+}
+
+void AVisionVehiclesPawn::AddTrainingSample(const TArray<float>& inputs, const TArray<float>& expectedOutputs)
+{
+	if (!experienceReplay.IsValid())
+	{
+		NeuralNetwork->Train(inputs, expectedOutputs);
+		return;
+	}
+	if (inputs.Num() != experienceReplay->GetNumInputs() || expectedOutputs.Num() != experienceReplay->GetNumOutputs())
 	{
-		verticalProjectionHistogram[i] /= totalCount;
+		UE_LOG(LogTemp, Warning, TEXT("Trying to add a training sample with wrong dimensions: %d inputs - %d outputs."), inputs.Num(), expectedOutputs.Num());
+		return;
 	}
+	experienceReplay->Push(inputs.GetData(), expectedOutputs.GetData());
+}
 
-	// Compute the inputs from the vertical projection histogram
-	float t = 0.0f, m = 0.5f, s = 0.0f, k = 0.0f, sk = 0.0f, u = 0.0f, e = 0.0f;
-	if (totalCount > 0)
+float AVisionVehiclesPawn::GetTrainingSamplesPerSecond() const
+{
+	if (experienceReplay.IsValid())
 	{
-		m = 0.0f;
-		for (int i = 0; i < n; i++)
+		return experienceReplay->GetStats().TrainedPerSecond;
+	}
+	return NeuralNetwork != nullptr ? NeuralNetwork->GetTrainingSamplesPerSecond() : 0.0f;
+}
+
+void AVisionVehiclesPawn::AddReward(float reward)
+{
+	pendingReward += reward;
+}
+
+void AVisionVehiclesPawn::RecordTick()
+{
+	// The inputs are computed on the stack, so recording a tick doesn't allocate
+	float inputs[NumFeedInputs];
+	ProcessCameraFeed(TArrayView<float>(inputs, NumFeedInputs));
+	const FVisionMask& feed = GetVisionComponent()->GetClassFeed(trackFeaturesClass);
+	if (!recorder.IsValid())
+	{
+		// Wait for the first feed, so the number of inputs and the size of the feed are known
+		if (bRecordMasks && feed.Num() == 0)
 		{
-			m += i * verticalProjectionHistogram[i];
+			return;
 		}
-		for (int i = 0; i < n; i++)
+		FString fileName = FPaths::Combine(FPaths::GameSavedDir(), RecordingDirectory, FString::Printf(TEXT("%s_%s.vvdrec"), *GetName(), *FDateTime::Now().ToString()));
+		recorder = FDriveRecorder::Create(fileName, NumFeedInputs, bRecordMasks ? feed.Width : 0, bRecordMasks ? feed.Height : 0, RecordingSlots);
+		if (!recorder.IsValid())
 		{
-			s += FMath::Pow(i - m, 2.0f) * verticalProjectionHistogram[i];
-			//k += FMath::Pow(i - m, 4.0f) * verticalProjectionHistogram[i];
-			sk += FMath::Pow(i - m, 3.0f) * verticalProjectionHistogram[i];
-			//u += FMath::Pow(verticalProjectionHistogram[i], 2.0f);
-			//if (verticalProjectionHistogram[i] > 0.0f)
-			//	e -= verticalProjectionHistogram[i] * FMath::Log2(verticalProjectionHistogram[i]);
+			bRecordDrive = false;
+			return;
 		}
+	}
 
-		s = FMath::Sqrt(s);
-		//k = k / FMath::Pow(s, 4.0f) - 3.0f;
-		sk = sk / FMath::Pow(s, 3.0f);
+	FDriveRecord record;
+	record.Time = GetWorld()->GetTimeSeconds();
+	record.Speed = GetVehicleMovement()->GetForwardSpeed();
+	record.Throttle = lastThrottle;
+	record.Steering = lastSteering;
+	record.Reward = pendingReward;
+	record.FrameId = feed.FrameId;
+	recorder->Record(record, inputs, bRecordMasks ? &feed : nullptr);
+	pendingReward = 0.0f;
+}
 
-		t = (float)totalCount / (n * n);
-		m = m / n;
-		s = s / n;
+float AVisionVehiclesPawn::TrainFromRecording(const FString& fileName, int32 numEpochs, int32 batchSize, int32 seed)
+{
+	TSharedPtr<FDriveRecording, ESPMode::ThreadSafe> recording = FDriveRecording::Open(FPaths::ConvertRelativePathToFull(FPaths::GameSavedDir(), fileName));
+	if (!recording.IsValid() || NeuralNetwork == nullptr)
+	{
+		return -1.0f;
 	}
 
-	return TArray<float>({ t, m, s, sk, GetVehicleMovement()->GetForwardSpeed() / 2500.0f });
+	FRandomStream random(seed != 0 ? seed : (int32)FPlatformTime::Cycles());
+	float error = -1.0f;
+	for (int32 epoch = 0; epoch < numEpochs; epoch++)
+	{
+		error = recording->TrainEpoch(NeuralNetwork, batchSize, random);
+		if (error < 0.0f)
+		{
+			break;
+		}
+	}
+	return error;
 }
 
 #undef LOCTEXT_NAMESPACE
@@ -1,6 +1,9 @@
 // Copyright 1998-2017 Epic Games, Inc. All Rights Reserved.
 #pragma once
 #include "WheeledVehicle.h"
+#include "VisionFeatures.h"
+#include "DriveRecording.h"
+#include "ExperienceReplay.h"
 #include "VisionVehiclesPawn.generated.h"
 
 class UCameraComponent;
@@ -42,6 +45,10 @@ class AVisionVehiclesPawn : public AWheeledVehicle
 	UPROPERTY(Category = Vision, VisibleDefaultsOnly, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
 	UVehicleVisionComponent* VisionComponent;
 
+	/* The label of the vision class processed to find the track. If it is none or not found, the first class is used. */
+	UPROPERTY(Category = Vision, EditAnywhere, BlueprintReadWrite, meta = (AllowPrivateAccess = "true"))
+	FName TrackVisionClass;
+
 	/** The number of inputs of the NN */
 	UPROPERTY(Category = "AI|Neural Network", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true", UIMin = "1"))
 	int NumberOfInputs;
@@ -62,6 +69,52 @@ class AVisionVehiclesPawn : public AWheeledVehicle
 	UPROPERTY(Category = "AI|Neural Network", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
 	float LearningRateDecay;
 
+	/** A file with a trained NN to load on BeginPlay, relative to the project directory. If empty or it can't be loaded, the NN is initialized randomly.
+	 *	All the pawns that load the same file share one copy of its weights, until they train their NN. */
+	UPROPERTY(Category = "AI|Neural Network", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	FString NeuralNetworkFile;
+
+	/** Whether AddTrainingSample pushes the samples into an experience replay buffer, from which a background task trains the NN
+	 *	with mini-batches, instead of training the NN with each sample in turn on the game thread. */
+	UPROPERTY(Category = "AI|Experience Replay", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	bool bUseExperienceReplay;
+
+	/** The number of samples the buffer holds. When it is full, the oldest samples are replaced. */
+	UPROPERTY(Category = "AI|Experience Replay", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true", ClampMin = "1", UIMin = "256", UIMax = "1048576"))
+	int32 ReplayCapacity;
+
+	/** How the samples of the mini-batches are drawn from the buffer */
+	UPROPERTY(Category = "AI|Experience Replay", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	EExperienceSampling ReplaySampling;
+
+	/** The number of samples in each mini-batch, and the number of mini-batches trained each time the background task runs (at most once per frame) */
+	UPROPERTY(Category = "AI|Experience Replay", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true", ClampMin = "1", UIMin = "1", UIMax = "256"))
+	int32 ReplayBatchSize;
+
+	UPROPERTY(Category = "AI|Experience Replay", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true", ClampMin = "1", UIMin = "1", UIMax = "64"))
+	int32 ReplayBatchesPerRound;
+
+	/** The pawns with the same group share one buffer, and one NN trained with the samples of all of them. If it is none, the pawn has its own. */
+	UPROPERTY(Category = "AI|Experience Replay", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	FName ReplayGroup;
+
+	/** Whether to record the drive: each tick, the outputs of ProcessCameraFeed, the speed, the last throttle and steering
+	 *	and the reward are written to a new file in RecordingDirectory, which FDriveRecording reads. It is also enabled with -VVRecord on the command line. */
+	UPROPERTY(Category = "AI|Recording", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	bool bRecordDrive;
+
+	/** Whether to also record the packed track feed of each tick */
+	UPROPERTY(Category = "AI|Recording", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	bool bRecordMasks;
+
+	/** The directory the recordings are written to, relative to the Saved directory */
+	UPROPERTY(Category = "AI|Recording", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true"))
+	FString RecordingDirectory;
+
+	/** The number of ticks that can wait to be written to the recording. Ticks are dropped rather than waited for when they are all in use. */
+	UPROPERTY(Category = "AI|Recording", EditAnywhere, BlueprintReadOnly, meta = (AllowPrivateAccess = "true", ClampMin = "1", UIMin = "64", UIMax = "16384"))
+	int32 RecordingSlots;
+
 public:
 	AVisionVehiclesPawn();
 
@@ -99,6 +152,7 @@ public:
 	virtual void Tick(float Delta) override;
 protected:
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 public:
 	// End Actor interface
@@ -124,12 +178,41 @@ public:
 	static const FName LookUpBinding;
 	static const FName LookRightBinding;
 
+	/* The number of inputs ProcessCameraFeed computes */
+	static const int32 NumFeedInputs = 5;
+
 	/* Process the feed from the vision component an creates the inputs array for the NN */
 	UFUNCTION(BlueprintCallable)
 	TArray<float> ProcessCameraFeed();
 
+	/* Processes the feed like the overload above, writing the inputs into the given span, which must have NumFeedInputs elements.
+	 *	It doesn't allocate. Returns false if the span has another size. */
+	bool ProcessCameraFeed(TArrayView<float> inputs);
+
+	/* Counts the pixels of the feed on each side that are equal to the checked value. The feed has the given width, or is square if it is 0 */
 	UFUNCTION(BlueprintCallable)
-	FVector2D FindTrackEnd(TArray<bool> cameraFeed);
+	FVector2D FindTrackEnd(const TArray<bool>& cameraFeed, int32 width = 0);
+
+	/* Counts the pixels of the packed feed on each side like the overload above, without unpacking it */
+	FVector2D FindTrackEnd(const FVisionMask& cameraFeed);
+
+	/* Trains the NN with a sample, or pushes it into the experience replay buffer if it is used */
+	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
+	void AddTrainingSample(const TArray<float>& inputs, const TArray<float>& expectedOutputs);
+
+	/* Returns the number of samples per second the NN is trained with, by the experience replay task if it is used */
+	UFUNCTION(BlueprintCallable, Category = "AI|Neural Network")
+	float GetTrainingSamplesPerSecond() const;
+
+	/* Adds to the reward recorded with the current tick */
+	UFUNCTION(BlueprintCallable, Category = "AI|Recording")
+	void AddReward(float reward);
+
+	/* Trains the NN with a drive recording, relative to the Saved directory, for the given number of epochs in shuffled mini-batches.
+	 *	The batches are shuffled from the given seed if it is not 0, so training again from the same NN gives the same result.
+	 *	The expected outputs are the recorded steering, then throttle. Returns the mean error of the last epoch, or -1 on failure. */
+	UFUNCTION(BlueprintCallable, Category = "AI|Recording")
+	float TrainFromRecording(const FString& fileName, int32 numEpochs = 1, int32 batchSize = 32, int32 seed = 0);
 
 private:
 	/** 
@@ -143,6 +226,9 @@ private:
 	/** Update the gear and speed strings */
 	void UpdateHUDStrings();
 
+	/* Records the current tick, creating the recording on the first one */
+	void RecordTick();
+
 	/* Are we on a 'slippery' surface */
 	bool bIsLowFriction;
 
@@ -150,6 +236,23 @@ private:
 	UPROPERTY()
 	UNeuralNetwork* NeuralNetwork;
 
+	/* The features of the track feed, and the feed version and class they were computed from. They are reused until there is a new capture */
+	FVisionFeatures trackFeatures;
+	uint32 trackFeaturesVersion;
+	int32 trackFeaturesClass;
+
+	/* The last throttle and steering inputs applied by MoveForward and MoveRight, and the reward added since the last recorded tick */
+	float lastThrottle;
+	float lastSteering;
+	float pendingReward;
+
+	/* The recorder of the drive, while it is recorded */
+	TUniquePtr<FDriveRecorder> recorder;
+
+	/* The experience replay buffer, if it is used, and the version of its weights the NN has */
+	TSharedPtr<FExperienceReplay, ESPMode::ThreadSafe> experienceReplay;
+	uint32 experienceReplayVersion;
+
 public:
 	/** Returns SpringArm subobject **/
 	FORCEINLINE USpringArmComponent* GetSpringArm() const { return SpringArm; }
@@ -163,6 +266,8 @@ public:
 	FORCEINLINE UTextRenderComponent* GetInCarGear() const { return InCarGear; }
 	/** Returns vision component **/
 	FORCEINLINE UVehicleVisionComponent* GetVisionComponent() const { return VisionComponent; }
+	/** Returns the features of the track feed last computed by ProcessCameraFeed */
+	FORCEINLINE const FVisionFeatures& GetTrackFeatures() const { return trackFeatures; }
 	/** Return the neural network used by this pawn */
 	UFUNCTION(BlueprintCallable)
 	FORCEINLINE UNeuralNetwork* GetNeuralNetwork() const { return NeuralNetwork; }